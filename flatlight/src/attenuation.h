@@ -0,0 +1,80 @@
+#pragma once
+
+#include <float.h>
+#include <math.h>
+
+// Attenuation models, each giving how much of a light's colour reaches a tile at
+// a squared distance from it, from the light's linear and quadratic falloff, and
+// the radius past which that is less than 1/255, the smallest step of the 8-bit colour
+// The lighting is built for ATTENUATION_MODEL, picked at compile time so the
+// loops over tiles have no branch on it
+
+// 1 / (1 + linear * d + quadratic * d^2), linear falloff with a quadratic of 0 and the other way around
+struct polynomial_attenuation_t
+{
+	static float attenuate(float linear, float quadratic, float distance_squared)
+	{
+		const float dist = sqrt(distance_squared);
+
+		return 1.0f / (1.0f + linear*dist + quadratic*dist*dist);
+	}
+
+	static float radius(float linear, float quadratic)
+	{
+		// Solve 1 / (1 + linear * d + quadratic * d^2) = 1 / 255 for d
+		const float k = 254.0f;
+
+		if (quadratic > 0.0f)
+			return (-linear + sqrt(linear * linear + 4.0f * quadratic * k)) / (2.0f * quadratic);
+
+		if (linear > 0.0f)
+			return k / linear;
+
+		// Never falls off
+		return FLT_MAX;
+	}
+};
+
+// 1 / (1 + quadratic * d^2) cut to nothing past the radius, linear is ignored
+struct inverse_square_attenuation_t
+{
+	static float attenuate(float /*linear*/, float quadratic, float distance_squared)
+	{
+		const float att = 1.0f / (1.0f + quadratic * distance_squared);
+
+		return (att < 1.0f / 255.0f ? 0.0f : att);
+	}
+
+	static float radius(float /*linear*/, float quadratic)
+	{
+		return (quadratic > 0.0f ? sqrt(254.0f / quadratic) : FLT_MAX);
+	}
+};
+
+// (1 - d^2 / r^2)^2 over the polynomial model's radius r, full brightness at
+// the light and fading smoothly to nothing at the edge
+struct smooth_attenuation_t
+{
+	static float attenuate(float linear, float quadratic, float distance_squared)
+	{
+		const float r = polynomial_attenuation_t::radius(linear, quadratic);
+
+		if (r == FLT_MAX)
+			return 1.0f;
+
+		const float t = 1.0f - distance_squared / (r * r);
+
+		return (t > 0.0f ? t * t : 0.0f);
+	}
+
+	static float radius(float linear, float quadratic)
+	{
+		return polynomial_attenuation_t::radius(linear, quadratic);
+	}
+};
+
+#ifndef ATTENUATION_MODEL
+#define ATTENUATION_MODEL polynomial_attenuation_t
+#endif
+
+typedef ATTENUATION_MODEL attenuation_model_t;
@@ -0,0 +1,114 @@
+#include "headless.h"
+
+#include "image.h"
+#include "level.h"
+#include "levelstream.h"
+#include "lightmanager.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#include <SDL2/SDL.h>
+
+frame_stats_t computeFrameStats(const double* frame_seconds, int frame_count, int tiles_per_frame)
+{
+	frame_stats_t stats{ frame_count, 0.0, 0.0, 0.0, 0.0 };
+
+	if (frame_count < 1)
+		return stats;
+
+	std::vector<double> sorted(frame_seconds, frame_seconds + frame_count);
+	std::sort(sorted.begin(), sorted.end());
+
+	double total = 0.0;
+
+	for (int i = 0; i < frame_count; ++i)
+		total += sorted[i];
+
+	// Nearest rank percentiles
+	const int median_rank = (frame_count + 1) / 2;
+	const int p99_rank = (frame_count * 99 + 99) / 100;
+
+	stats.min_ms = sorted[0] * 1000.0;
+	stats.median_ms = sorted[median_rank - 1] * 1000.0;
+	stats.p99_ms = sorted[p99_rank - 1] * 1000.0;
+
+	if (total > 0.0)
+		stats.tiles_per_second = (double)tiles_per_frame * frame_count / total;
+
+	return stats;
+}
+
+void printFrameStats(const frame_stats_t& stats)
+{
+	printf("Frames: %d, min %.3f ms, median %.3f ms, p99 %.3f ms, %.1f Mtiles/s\n", stats.frames,
+		stats.min_ms, stats.median_ms, stats.p99_ms, stats.tiles_per_second / 1000000.0);
+}
+
+int runHeadless(visibility_mode_t mode, int frame_count, const char* output_filename)
+{
+	if (frame_count < 1)
+		frame_count = 1;
+
+	std::vector<double> frame_seconds(frame_count);
+
+	const double frequency = (double)SDL_GetPerformanceFrequency();
+
+	for (int frame = 0; frame < frame_count; ++frame)
+	{
+		Uint64 start = SDL_GetPerformanceCounter();
+
+		updateLevelStream();
+
+		// Relight every tile each frame, as the main loop does when everything changes
+		lightLevel(mode);
+
+		// A streamed level's lights and regions wait for their chunks, so the
+		// frame isn't done until they are all loaded and lit
+		while (isLevelStreamLoading() || isLevelStreamWaiting())
+		{
+			waitForLevelStream();
+
+			const bool loaded = updateLevelStream();
+
+			if (!updateLighting(mode) && !loaded && !isLevelStreamLoading())
+				break;
+		}
+
+		frame_seconds[frame] = (SDL_GetPerformanceCounter() - start) / frequency;
+	}
+
+	printf("Visibility mode: %s, lights: %d, wall segments: %d\n", getVisibilityModeName(mode), getLightCount(),
+		getWallSegmentCount());
+	printf("Visibility cache: %d KB, falloff cache: %d KB\n", (int)(getVisibilityCacheBytes() >> 10),
+		(int)(getFalloffCacheBytes() >> 10));
+
+	if (isLevelStreamed())
+	{
+		// Lights that need more chunks than fit the budget are left unlit
+		printf("Level stream: %d KB%s\n", (int)(getLevelStreamBytes() >> 10),
+			(isLevelStreamWaiting() ? ", too small for some lights" : ""));
+	}
+
+	// Only the tiles of the lightmap are lit
+	const tile_rect_t rect = getLightmapRect();
+
+	const int lightmap_width = rect.x_end - rect.x_begin;
+	const int lightmap_height = rect.y_end - rect.y_begin;
+
+	if (lightmap_width != level_width || lightmap_height != level_height)
+		printf("Lightmap: %d x %d tiles at (%d, %d)\n", lightmap_width, lightmap_height, rect.x_begin, rect.y_begin);
+
+	printFrameStats(computeFrameStats(&frame_seconds[0], frame_count, lightmap_width * lightmap_height));
+
+	if (output_filename != nullptr)
+	{
+		if (!writeImage(output_filename, getLightmap(), lightmap_width, lightmap_height))
+			return 1;
+
+		printf("Wrote %s\n", output_filename);
+	}
+
+	return 0;
+}
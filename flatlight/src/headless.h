@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "lighting.h"
+
+// Timings of a run of frames
+struct frame_stats_t
+{
+	int frames;
+	double min_ms;
+	double median_ms;
+	double p99_ms;
+	double tiles_per_second;
+};
+
+// Works out min, median and 99th percentile frame times, and tiles lit per
+// second over the whole run, from a list of frame times in seconds
+frame_stats_t computeFrameStats(const double* frame_seconds, int frame_count, int tiles_per_frame);
+void printFrameStats(const frame_stats_t& stats);
+
+// Lights the level, or the lighting view set with setLightingView(), with the light manager's lights
+// frame_count times with no window or SDL video, prints the frame timings and writes the last frame's
+// lightmap to output_filename unless it is null
+// Returns the exit code for main()
+int runHeadless(visibility_mode_t mode, int frame_count, const char* output_filename);
@@ -0,0 +1,186 @@
+#include "image.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// Appends the RGB bytes of a row of ABGR8888 pixels
+static void appendRGB(std::vector<uint8_t>& out, const uint32_t* row, int width)
+{
+	for (int x = 0; x < width; ++x)
+	{
+		out.push_back((uint8_t)(row[x] & 0xff));
+		out.push_back((uint8_t)((row[x] >> 8) & 0xff));
+		out.push_back((uint8_t)((row[x] >> 16) & 0xff));
+	}
+}
+
+static bool writeFile(const char* filename, const std::vector<uint8_t>& data)
+{
+	FILE* file = fopen(filename, "wb");
+
+	if (file == nullptr)
+	{
+		fprintf(stderr, "Failed to open file for writing: %s\n", filename);
+		return false;
+	}
+
+	bool ok = (fwrite(&data[0], 1, data.size(), file) == data.size());
+
+	if (fclose(file) != 0)
+		ok = false;
+
+	if (!ok)
+		fprintf(stderr, "Failed to write file: %s\n", filename);
+
+	return ok;
+}
+
+bool writePPM(const char* filename, const uint32_t* pixels, int width, int height)
+{
+	char header[64];
+	int header_length = sprintf(header, "P6\n%d %d\n255\n", width, height);
+
+	std::vector<uint8_t> data(header, header + header_length);
+	data.reserve(header_length + width * height * 3);
+
+	for (int y = 0; y < height; ++y)
+		appendRGB(data, &pixels[y * width], width);
+
+	return writeFile(filename, data);
+}
+
+static void appendBigEndian(std::vector<uint8_t>& out, uint32_t value)
+{
+	out.push_back((uint8_t)(value >> 24));
+	out.push_back((uint8_t)(value >> 16));
+	out.push_back((uint8_t)(value >> 8));
+	out.push_back((uint8_t)value);
+}
+
+static uint32_t crc32(const uint8_t* data, size_t length)
+{
+	static uint32_t table[256];
+	static bool table_ready = false;
+
+	if (!table_ready)
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t c = i;
+
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1);
+
+			table[i] = c;
+		}
+
+		table_ready = true;
+	}
+
+	uint32_t crc = 0xffffffffu;
+
+	for (size_t i = 0; i < length; ++i)
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+	return crc ^ 0xffffffffu;
+}
+
+static uint32_t adler32(const uint8_t* data, size_t length)
+{
+	uint32_t a = 1;
+	uint32_t b = 0;
+
+	for (size_t i = 0; i < length; ++i)
+	{
+		a = (a + data[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+
+	return (b << 16) | a;
+}
+
+// Appends a PNG chunk, the CRC covers the type and the data
+static void appendChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data)
+{
+	appendBigEndian(out, (uint32_t)data.size());
+
+	const size_t start = out.size();
+
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+
+	appendBigEndian(out, crc32(&out[start], out.size() - start));
+}
+
+// PNG without compression, the image data is stored in uncompressed deflate
+// blocks so no zlib is needed, the files are only a little larger than a PPM
+bool writePNG(const char* filename, const uint32_t* pixels, int width, int height)
+{
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+	std::vector<uint8_t> png(signature, signature + 8);
+
+	// 8-bit RGB, no interlacing
+	std::vector<uint8_t> header;
+	appendBigEndian(header, width);
+	appendBigEndian(header, height);
+	header.push_back(8);
+	header.push_back(2);
+	header.push_back(0);
+	header.push_back(0);
+	header.push_back(0);
+
+	appendChunk(png, "IHDR", header);
+
+	// Each row starts with filter type 0 (none)
+	std::vector<uint8_t> raw;
+	raw.reserve(height * (width * 3 + 1));
+
+	for (int y = 0; y < height; ++y)
+	{
+		raw.push_back(0);
+		appendRGB(raw, &pixels[y * width], width);
+	}
+
+	// zlib stream of stored blocks of up to 65535 bytes each
+	std::vector<uint8_t> compressed;
+	compressed.push_back(0x78);
+	compressed.push_back(0x01);
+
+	size_t offset = 0;
+
+	do
+	{
+		const size_t block_length = (raw.size() - offset < 65535 ? raw.size() - offset : 65535);
+		const bool last = (offset + block_length == raw.size());
+
+		compressed.push_back(last ? 1 : 0);
+		compressed.push_back((uint8_t)(block_length & 0xff));
+		compressed.push_back((uint8_t)(block_length >> 8));
+		compressed.push_back((uint8_t)(~block_length & 0xff));
+		compressed.push_back((uint8_t)((~block_length >> 8) & 0xff));
+
+		compressed.insert(compressed.end(), raw.begin() + offset, raw.begin() + offset + block_length);
+
+		offset += block_length;
+	}
+	while (offset < raw.size());
+
+	appendBigEndian(compressed, adler32(&raw[0], raw.size()));
+
+	appendChunk(png, "IDAT", compressed);
+	appendChunk(png, "IEND", std::vector<uint8_t>());
+
+	return writeFile(filename, png);
+}
+
+bool writeImage(const char* filename, const uint32_t* pixels, int width, int height)
+{
+	const char* extension = strrchr(filename, '.');
+
+	if (extension != nullptr && (strcmp(extension, ".png") == 0 || strcmp(extension, ".PNG") == 0))
+		return writePNG(filename, pixels, width, height);
+
+	return writePPM(filename, pixels, width, height);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+
+// Writes a colour buffer in the render texture's format (ABGR8888) to an
+// image file, alpha is dropped, returns false if the file can't be written
+bool writePPM(const char* filename, const uint32_t* pixels, int width, int height);
+bool writePNG(const char* filename, const uint32_t* pixels, int width, int height);
+
+// Picks PNG or PPM from the file extension, PPM if it is neither
+bool writeImage(const char* filename, const uint32_t* pixels, int width, int height);
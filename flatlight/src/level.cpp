@@ -0,0 +1,870 @@
+#include "level.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Level width, height, and buffer
+int level_width;
+int level_height;
+char* level;
+
+// Tiles of each chunk
+char** level_chunks = nullptr;
+
+// Occupancy bitmaps
+uint64_t* occupancy = nullptr;
+uint64_t* occupancy_transposed = nullptr;
+int occupancy_row_words;
+int occupancy_column_words;
+
+// Occupancy pyramid, level 0 is unused as the bitmaps cover single tiles
+uint8_t* occupancy_pyramid[OCCUPANCY_PYRAMID_LEVELS + 1] = {};
+int occupancy_pyramid_width[OCCUPANCY_PYRAMID_LEVELS + 1];
+static int occupancy_pyramid_height[OCCUPANCY_PYRAMID_LEVELS + 1];
+
+// Rays only skip blocks of at least this pyramid level, smaller ones cost more to
+// work out than the few tiles they save
+const int MIN_SKIP_LEVEL = 2;
+
+// Chebyshev distance from each tile to the nearest wall
+uint8_t* wall_distance = nullptr;
+
+// Rays only skip squares of empty tiles at least this far out from the
+// current tile when using the distance field
+const int MIN_SKIP_DISTANCE = 2;
+
+// Wall segments along each grid line
+std::vector<std::vector<wall_segment_t>> horizontal_segments;
+std::vector<std::vector<wall_segment_t>> vertical_segments;
+
+// Rays at least this many times closer to one axis than the other are walked
+// in runs along it, checking a stretch of the occupancy bitmap at a time
+const float RUN_RATIO = 4.0f;
+
+// Works out one pyramid block from the tiles or blocks below it
+static void buildPyramidBlock(int k, int block_x, int block_y)
+{
+	uint8_t occupied = 0;
+
+	if (k == 1)
+	{
+		for (int i = 0; i < 4; ++i)
+			occupied |= isWall(block_x * 2 + (i & 1), block_y * 2 + (i >> 1));
+	}
+	else
+	{
+		const int width = occupancy_pyramid_width[k - 1];
+		const int height = occupancy_pyramid_height[k - 1];
+
+		for (int i = 0; i < 4; ++i)
+		{
+			const int x = block_x * 2 + (i & 1);
+			const int y = block_y * 2 + (i >> 1);
+
+			occupied |= (x >= width || y >= height || occupancy_pyramid[k - 1][y * width + x]);
+		}
+	}
+
+	occupancy_pyramid[k][block_y * occupancy_pyramid_width[k] + block_x] = occupied;
+}
+
+// Works out the wall distance of every tile in box from scratch, taking the
+// tiles around it as already right, in one pass down and one back up
+static void buildWallDistance(const tile_rect_t& box)
+{
+	for (int y = box.y_begin; y < box.y_end; ++y)
+	{
+		for (int x = box.x_begin; x < box.x_end; ++x)
+			wall_distance[y * level_width + x] = (isOccupied(x, y) ? 0 : MAX_WALL_DISTANCE);
+	}
+
+	// Down and to the right from the row above and the tile to the left, then up and to the left
+	static const int forward[4][2] = { { -1, -1 }, { 0, -1 }, { 1, -1 }, { -1, 0 } };
+	static const int backward[4][2] = { { 1, 1 }, { 0, 1 }, { -1, 1 }, { 1, 0 } };
+
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		const int (*neighbours)[2] = (pass == 0 ? forward : backward);
+
+		const int step = (pass == 0 ? 1 : -1);
+
+		const int first_y = (pass == 0 ? box.y_begin : box.y_end - 1);
+		const int first_x = (pass == 0 ? box.x_begin : box.x_end - 1);
+
+		for (int y = first_y; y >= box.y_begin && y < box.y_end; y += step)
+		{
+			for (int x = first_x; x >= box.x_begin && x < box.x_end; x += step)
+			{
+				uint8_t& distance = wall_distance[y * level_width + x];
+
+				for (int i = 0; i < 4 && distance != 0; ++i)
+				{
+					int neighbour = getWallDistance(x + neighbours[i][0], y + neighbours[i][1]) + 1;
+
+					if (neighbour < distance)
+						distance = (uint8_t)neighbour;
+				}
+			}
+		}
+	}
+}
+
+char* allocateLevel(int width, int height)
+{
+	const size_t size = getLevelStorageSize(width, height);
+
+	char* tiles = new char[size];
+	memset(tiles, '#', size);
+
+	return tiles;
+}
+
+void buildLevelChunks()
+{
+	delete[] level_chunks;
+
+	const size_t chunk_count = getLevelStorageSize(level_width, level_height) / LEVEL_CHUNK_TILES;
+
+	level_chunks = new char*[chunk_count];
+
+	for (size_t i = 0; i < chunk_count; ++i)
+		level_chunks[i] = (level != nullptr ? &level[i * LEVEL_CHUNK_TILES] : nullptr);
+}
+
+void freeLevelChunks()
+{
+	delete[] level_chunks;
+	level_chunks = nullptr;
+}
+
+void buildOccupancy()
+{
+	delete[] occupancy;
+	delete[] occupancy_transposed;
+
+	// Two more bits per row and column for the border
+	occupancy_row_words = (level_width + 2 + 63) / 64;
+	occupancy_column_words = (level_height + 2 + 63) / 64;
+
+	const int row_count = level_height + 2;
+	const int column_count = level_width + 2;
+
+	occupancy = new uint64_t[row_count * occupancy_row_words];
+	occupancy_transposed = new uint64_t[column_count * occupancy_column_words];
+
+	memset(occupancy, 0, row_count * occupancy_row_words * sizeof(uint64_t));
+	memset(occupancy_transposed, 0, column_count * occupancy_column_words * sizeof(uint64_t));
+
+	for (int y = -1; y <= level_height; ++y)
+	{
+		for (int x = -1; x <= level_width; ++x)
+		{
+			bool border = (x < 0 || y < 0 || x >= level_width || y >= level_height);
+
+			if (border || !isTileLoaded(x, y) || getTile(x, y) == '#')
+			{
+				occupancy[(y + 1) * occupancy_row_words + ((x + 1) >> 6)] |= 1ull << ((x + 1) & 63);
+				occupancy_transposed[(x + 1) * occupancy_column_words + ((y + 1) >> 6)] |= 1ull << ((y + 1) & 63);
+			}
+		}
+	}
+
+	for (int k = 1; k <= OCCUPANCY_PYRAMID_LEVELS; ++k)
+	{
+		delete[] occupancy_pyramid[k];
+
+		const int size = 1 << k;
+
+		occupancy_pyramid_width[k] = (level_width + size - 1) / size;
+		occupancy_pyramid_height[k] = (level_height + size - 1) / size;
+
+		occupancy_pyramid[k] = new uint8_t[occupancy_pyramid_width[k] * occupancy_pyramid_height[k]];
+
+		for (int y = 0; y < occupancy_pyramid_height[k]; ++y)
+		{
+			for (int x = 0; x < occupancy_pyramid_width[k]; ++x)
+				buildPyramidBlock(k, x, y);
+		}
+	}
+
+	delete[] wall_distance;
+
+	wall_distance = nullptr;
+
+	if (level != nullptr)
+	{
+		wall_distance = new uint8_t[level_width * level_height];
+
+		buildWallDistance(getLevelRect());
+	}
+}
+
+void freeOccupancy()
+{
+	delete[] occupancy;
+	delete[] occupancy_transposed;
+
+	occupancy = nullptr;
+	occupancy_transposed = nullptr;
+
+	for (int k = 1; k <= OCCUPANCY_PYRAMID_LEVELS; ++k)
+	{
+		delete[] occupancy_pyramid[k];
+		occupancy_pyramid[k] = nullptr;
+	}
+
+	delete[] wall_distance;
+	wall_distance = nullptr;
+}
+
+// Redoes the wall distances around a tile that has just changed
+// Going out a ring of tiles at a time, a new wall can only bring tiles closer
+// and a removed one only matters to tiles it was nearest to, and once a whole
+// ring is unaffected so is everything further out, so only the square inside
+// that ring is worked out again, against the ring's distances
+static void updateWallDistance(int x, int y, bool wall)
+{
+	int radius = 1;
+
+	for (;; ++radius)
+	{
+		const tile_rect_t ring = intersectRects(tile_rect_t{ x - radius, y - radius, x + radius + 1, y + radius + 1 }, getLevelRect());
+
+		bool affected = false;
+
+		for (int ring_y = ring.y_begin; ring_y < ring.y_end && !affected; ++ring_y)
+		{
+			// Only the first and last columns unless this is the top or bottom row
+			const bool edge_row = (ring_y == y - radius || ring_y == y + radius);
+			const int x_step = (edge_row ? 1 : 2 * radius);
+
+			for (int ring_x = x - radius; ring_x <= x + radius; ring_x += x_step)
+			{
+				if (!isInRect(ring, ring_x, ring_y))
+					continue;
+
+				int distance = wall_distance[ring_y * level_width + ring_x];
+
+				if (wall ? distance > radius : distance == radius)
+				{
+					affected = true;
+					break;
+				}
+			}
+		}
+
+		if (!affected)
+			break;
+	}
+
+	buildWallDistance(intersectRects(tile_rect_t{ x - radius + 1, y - radius + 1, x + radius, y + radius }, getLevelRect()));
+}
+
+// Rebuilds the segments along the top edge of row y
+static void buildHorizontalSegments(int y)
+{
+	std::vector<wall_segment_t>& line = horizontal_segments[y];
+
+	line.clear();
+
+	for (int x = 0; x < level_width; ++x)
+	{
+		if (isOccupied(x, y - 1) == isOccupied(x, y))
+			continue;
+
+		// Extend the last segment if it ends at this tile with the wall on the same side
+		if (!line.empty() && line.back().x_end == x && isOccupied(x - 1, y) == isOccupied(x, y))
+			line.back().x_end = x + 1;
+		else
+			line.push_back(wall_segment_t{ x, y, x + 1, y });
+	}
+}
+
+// Rebuilds the segments along the left edge of column x
+static void buildVerticalSegments(int x)
+{
+	std::vector<wall_segment_t>& line = vertical_segments[x];
+
+	line.clear();
+
+	for (int y = 0; y < level_height; ++y)
+	{
+		if (isOccupied(x - 1, y) == isOccupied(x, y))
+			continue;
+
+		if (!line.empty() && line.back().y_end == y && isOccupied(x, y - 1) == isOccupied(x, y))
+			line.back().y_end = y + 1;
+		else
+			line.push_back(wall_segment_t{ x, y, x, y + 1 });
+	}
+}
+
+void buildWallSegments()
+{
+	horizontal_segments.assign(level_height + 1, std::vector<wall_segment_t>());
+	vertical_segments.assign(level_width + 1, std::vector<wall_segment_t>());
+
+	for (int y = 0; y <= level_height; ++y)
+		buildHorizontalSegments(y);
+
+	for (int x = 0; x <= level_width; ++x)
+		buildVerticalSegments(x);
+}
+
+int getWallSegmentCount()
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < horizontal_segments.size(); ++i)
+		count += horizontal_segments[i].size();
+
+	for (size_t i = 0; i < vertical_segments.size(); ++i)
+		count += vertical_segments[i].size();
+
+	return (int)count;
+}
+
+// Orders a line's segments against a coordinate, for searching with std::lower_bound
+static bool endsBeforeX(const wall_segment_t& segment, int x)
+{
+	return (segment.x_end <= x);
+}
+
+static bool endsBeforeY(const wall_segment_t& segment, int y)
+{
+	return (segment.y_end <= y);
+}
+
+void getWallSegments(const tile_rect_t& rect, std::vector<wall_segment_t>* segments)
+{
+	if (isRectEmpty(rect))
+		return;
+
+	for (int y = rect.y_begin; y <= rect.y_end; ++y)
+	{
+		const std::vector<wall_segment_t>& line = horizontal_segments[y];
+
+		// Segments on a line are sorted and don't overlap, so skip to the first one reaching the rect
+		for (auto it = std::lower_bound(line.begin(), line.end(), rect.x_begin, endsBeforeX);
+			it != line.end() && it->x_begin < rect.x_end; ++it)
+		{
+			segments->push_back(wall_segment_t{ std::max(it->x_begin, rect.x_begin), y, std::min(it->x_end, rect.x_end), y });
+		}
+	}
+
+	for (int x = rect.x_begin; x <= rect.x_end; ++x)
+	{
+		const std::vector<wall_segment_t>& line = vertical_segments[x];
+
+		for (auto it = std::lower_bound(line.begin(), line.end(), rect.y_begin, endsBeforeY);
+			it != line.end() && it->y_begin < rect.y_end; ++it)
+		{
+			segments->push_back(wall_segment_t{ x, std::max(it->y_begin, rect.y_begin), x, std::min(it->y_end, rect.y_end) });
+		}
+	}
+}
+
+// Rebuilds the segments along the top edge of row y over tiles x_first to
+// x_last (inclusive), leaving the rest of the line as it is
+// Segments reaching the span or touching its ends are redone whole, as they
+// can merge with new ones in it, and past them nothing that decides a segment changed
+static void buildHorizontalSegments(int y, int x_first, int x_last)
+{
+	std::vector<wall_segment_t>& line = horizontal_segments[y];
+
+	auto first = std::lower_bound(line.begin(), line.end(), x_first - 1, endsBeforeX);
+	auto last = first;
+
+	while (last != line.end() && last->x_begin <= x_last + 1)
+		++last;
+
+	const int x_begin = (first != last ? std::min(x_first, first->x_begin) : x_first);
+	const int x_end = std::min((first != last ? std::max(x_last + 1, (last - 1)->x_end) : x_last + 1), level_width);
+
+	std::vector<wall_segment_t> span;
+
+	for (int x = std::max(x_begin, 0); x < x_end; ++x)
+	{
+		if (isOccupied(x, y - 1) == isOccupied(x, y))
+			continue;
+
+		if (!span.empty() && span.back().x_end == x && isOccupied(x - 1, y) == isOccupied(x, y))
+			span.back().x_end = x + 1;
+		else
+			span.push_back(wall_segment_t{ x, y, x + 1, y });
+	}
+
+	line.insert(line.erase(first, last), span.begin(), span.end());
+}
+
+// Rebuilds the segments along the left edge of column x over tiles y_first to y_last
+static void buildVerticalSegments(int x, int y_first, int y_last)
+{
+	std::vector<wall_segment_t>& line = vertical_segments[x];
+
+	auto first = std::lower_bound(line.begin(), line.end(), y_first - 1, endsBeforeY);
+	auto last = first;
+
+	while (last != line.end() && last->y_begin <= y_last + 1)
+		++last;
+
+	const int y_begin = (first != last ? std::min(y_first, first->y_begin) : y_first);
+	const int y_end = std::min((first != last ? std::max(y_last + 1, (last - 1)->y_end) : y_last + 1), level_height);
+
+	std::vector<wall_segment_t> span;
+
+	for (int y = std::max(y_begin, 0); y < y_end; ++y)
+	{
+		if (isOccupied(x - 1, y) == isOccupied(x, y))
+			continue;
+
+		if (!span.empty() && span.back().y_end == y && isOccupied(x, y - 1) == isOccupied(x, y))
+			span.back().y_end = y + 1;
+		else
+			span.push_back(wall_segment_t{ x, y, x, y + 1 });
+	}
+
+	line.insert(line.erase(first, last), span.begin(), span.end());
+}
+
+void setLevelTile(int x, int y, char tile)
+{
+	*getTilePointer(x, y) = tile;
+
+	uint64_t& row_word = occupancy[(y + 1) * occupancy_row_words + ((x + 1) >> 6)];
+	uint64_t& column_word = occupancy_transposed[(x + 1) * occupancy_column_words + ((y + 1) >> 6)];
+
+	const uint64_t row_bit = 1ull << ((x + 1) & 63);
+	const uint64_t column_bit = 1ull << ((y + 1) & 63);
+
+	if (tile == '#')
+	{
+		row_word |= row_bit;
+		column_word |= column_bit;
+	}
+	else
+	{
+		row_word &= ~row_bit;
+		column_word &= ~column_bit;
+	}
+
+	for (int k = 1; k <= OCCUPANCY_PYRAMID_LEVELS; ++k)
+		buildPyramidBlock(k, x >> k, y >> k);
+
+	if (wall_distance != nullptr)
+		updateWallDistance(x, y, tile == '#');
+
+	// Only the lines along the tile's four edges can change
+	if (!horizontal_segments.empty())
+	{
+		buildHorizontalSegments(y);
+		buildHorizontalSegments(y + 1);
+		buildVerticalSegments(x);
+		buildVerticalSegments(x + 1);
+	}
+}
+
+void updateLevelChunk(int chunk_x, int chunk_y)
+{
+	const tile_rect_t rect = intersectRects(tile_rect_t{ chunk_x * LEVEL_CHUNK_SIZE, chunk_y * LEVEL_CHUNK_SIZE,
+		(chunk_x + 1) * LEVEL_CHUNK_SIZE, (chunk_y + 1) * LEVEL_CHUNK_SIZE }, getLevelRect());
+
+	if (isRectEmpty(rect))
+		return;
+
+	for (int y = rect.y_begin; y < rect.y_end; ++y)
+	{
+		const char* tiles = getTilePointer(rect.x_begin, y) - rect.x_begin;
+
+		for (int x = rect.x_begin; x < rect.x_end; ++x)
+		{
+			uint64_t& row_word = occupancy[(y + 1) * occupancy_row_words + ((x + 1) >> 6)];
+			uint64_t& column_word = occupancy_transposed[(x + 1) * occupancy_column_words + ((y + 1) >> 6)];
+
+			const uint64_t row_bit = 1ull << ((x + 1) & 63);
+			const uint64_t column_bit = 1ull << ((y + 1) & 63);
+
+			if (tiles[x] == '#')
+			{
+				row_word |= row_bit;
+				column_word |= column_bit;
+			}
+			else
+			{
+				row_word &= ~row_bit;
+				column_word &= ~column_bit;
+			}
+		}
+	}
+
+	for (int k = 1; k <= OCCUPANCY_PYRAMID_LEVELS; ++k)
+	{
+		for (int block_y = rect.y_begin >> k; block_y <= (rect.y_end - 1) >> k; ++block_y)
+		{
+			for (int block_x = rect.x_begin >> k; block_x <= (rect.x_end - 1) >> k; ++block_x)
+				buildPyramidBlock(k, block_x, block_y);
+		}
+	}
+
+	// Lines along and across the chunk, including its bottom and right edges
+	if (!horizontal_segments.empty())
+	{
+		for (int y = rect.y_begin; y <= rect.y_end; ++y)
+			buildHorizontalSegments(y, rect.x_begin, rect.x_end - 1);
+
+		for (int x = rect.x_begin; x <= rect.x_end; ++x)
+			buildVerticalSegments(x, rect.y_begin, rect.y_end - 1);
+	}
+}
+
+// Returns true if any bit from first to last (inclusive) is set in a bitmap row
+static bool anyBitSet(const uint64_t* row, int first, int last)
+{
+	const int first_word = first >> 6;
+	const int last_word = last >> 6;
+
+	const uint64_t first_mask = ~0ull << (first & 63);
+	const uint64_t last_mask = ~0ull >> (63 - (last & 63));
+
+	if (first_word == last_word)
+		return (row[first_word] & first_mask & last_mask) != 0;
+
+	if (row[first_word] & first_mask)
+		return true;
+
+	// Whole words in between are skipped 64 tiles at a time
+	for (int i = first_word + 1; i < last_word; ++i)
+	{
+		if (row[i])
+			return true;
+	}
+
+	return (row[last_word] & last_mask) != 0;
+}
+
+// Returns true if every bit from first to last (inclusive) is set in a bitmap row
+static bool allBitsSet(const uint64_t* row, int first, int last)
+{
+	const int first_word = first >> 6;
+	const int last_word = last >> 6;
+
+	const uint64_t first_mask = ~0ull << (first & 63);
+	const uint64_t last_mask = ~0ull >> (63 - (last & 63));
+
+	if (first_word == last_word)
+		return (~row[first_word] & first_mask & last_mask) == 0;
+
+	if (~row[first_word] & first_mask)
+		return false;
+
+	for (int i = first_word + 1; i < last_word; ++i)
+	{
+		if (~row[i])
+			return false;
+	}
+
+	return (~row[last_word] & last_mask) == 0;
+}
+
+bool isRowOpen(int y, int x_first, int x_last)
+{
+	if (y < 0 || y >= level_height || x_first < 0 || x_last >= level_width)
+		return false;
+
+	return !anyBitSet(&occupancy[(y + 1) * occupancy_row_words], x_first + 1, x_last + 1);
+}
+
+bool isRowWall(int y, int x_first, int x_last)
+{
+	if (y < 0 || y >= level_height)
+		return true;
+
+	// The border is all walls, so only the part over the level needs checking
+	x_first = std::max(x_first, 0);
+	x_last = std::min(x_last, level_width - 1);
+
+	return (x_first > x_last || allBitsSet(&occupancy[(y + 1) * occupancy_row_words], x_first + 1, x_last + 1));
+}
+
+bool isColumnWall(int x, int y_first, int y_last)
+{
+	if (x < 0 || x >= level_width)
+		return true;
+
+	y_first = std::max(y_first, 0);
+	y_last = std::min(y_last, level_height - 1);
+
+	return (y_first > y_last || allBitsSet(&occupancy_transposed[(x + 1) * occupancy_column_words], y_first + 1, y_last + 1));
+}
+
+// Time along the ray at which it crosses the grid line for tile cur
+static inline float crossingTime(int cur, float coeff, float bias)
+{
+	return cur * coeff + bias;
+}
+
+// Returns true if a crossing at time t comes before limit, or at it if ties count
+static inline bool crossesBefore(float t, float limit, bool inclusive)
+{
+	return (inclusive ? !(limit < t) : t < limit);
+}
+
+// Number of steps from cur that the ray can take along one axis before its
+// crossing time reaches limit, evaluated exactly as the per-step loop would
+// inverse_coeff (the ray direction) is only used for a first estimate
+static int countSteps(int cur, int step, float coeff, float inverse_coeff, float bias, float limit, bool inclusive)
+{
+	// Estimate from the inverse of crossingTime(), then settle it against the
+	// rounded times since crossingTime() only ever grows along the ray
+	float estimate = ((limit - bias) * inverse_coeff - cur) * step;
+
+	if (estimate > 16777216.0f)
+		estimate = 16777216.0f;
+
+	int n = (estimate > 0.0f ? (int)estimate : 0);
+
+	while (crossesBefore(crossingTime(cur + (n + 1) * step, coeff, bias), limit, inclusive))
+		n++;
+
+	while (n > 0 && !crossesBefore(crossingTime(cur + n * step, coeff, bias), limit, inclusive))
+		n--;
+
+	return n;
+}
+
+// Returns the largest pyramid level at which the block over tile (x, y) is
+// empty, or 0 if the block at MIN_SKIP_LEVEL has a wall
+static inline int getEmptyBlockLevel(int x, int y)
+{
+	int k = 0;
+
+	for (int level = MIN_SKIP_LEVEL; level <= OCCUPANCY_PYRAMID_LEVELS && !isBlockOccupied(level, x, y); ++level)
+		k = level;
+
+	return k;
+}
+
+// Finds a rectangle of open tiles around (x, y) worth skipping across, from
+// the wall distances or the pyramid, returns false if there isn't one
+static inline bool getEmptyRect(int x, int y, bool distance_field, tile_rect_t* rect)
+{
+	if (distance_field)
+	{
+		const int reach = wall_distance[y * level_width + x] - 1;
+
+		if (reach < MIN_SKIP_DISTANCE)
+			return false;
+
+		*rect = tile_rect_t{ x - reach, y - reach, x + reach + 1, y + reach + 1 };
+	}
+	else
+	{
+		const int k = getEmptyBlockLevel(x, y);
+
+		if (k == 0)
+			return false;
+
+		*rect = tile_rect_t{ (x >> k) << k, (y >> k) << k, ((x >> k) + 1) << k, ((y >> k) + 1) << k };
+	}
+
+	return true;
+}
+
+// A fast raycast that skips to the next tile along the ray in a grid
+// An implementation of John Amanatides (1987) - A fast voxel traversal algorithm for ray tracing
+static inline bool castRay(int startx, int starty, int endx, int endy, bool distance_field)
+{
+	// Hit if the start tile is obstructed
+	if (isOccupied(startx, starty))
+	{
+		return true;
+	}
+
+	// No hit if the start tile is the end tile
+	if (startx == endx && starty == endy)
+	{
+		return false;
+	}
+
+	float diffx = endx - startx;
+	float diffy = endy - starty;
+
+	float length = sqrt(diffx * diffx + diffy * diffy);
+
+	float dx = diffx / length;
+	float dy = diffy / length;
+
+	if (abs(dx) < 0.0001f)
+		dx = 0.0001f;
+	if (abs(dy) < 0.0001f)
+		dy = 0.0001f;
+
+	int cur_tile_x = startx;
+	int cur_tile_y = starty;
+
+	// Calculate coefficient and bias for tx, ty calculation
+	// The calculation is tx = (x - x0) / dx, ty = (y - y0) / dy
+	// Which is derived from x = x0 + tdx, y = y0 + ydx
+	// And can then be simplified to a multiply add
+	// tx = x * (1/dx) + (- x0 / dx)
+	// or tx = x * dx_coeff + dx_bias
+	const float dx_coeff = 1.0f / dx;
+	const float dy_coeff = 1.0f / dy;
+
+	const float dx_bias = -(startx / dx);
+	const float dy_bias = -(starty / dy);
+
+	int dx_step = (dx > 0 ? 1 : -1);
+	int dy_step = (dy > 0 ? 1 : -1);
+
+	// Near axis aligned rays take many steps along one axis for each step along
+	// the other, so those steps are taken as a single run
+	const bool x_runs = (fabs(dx) >= RUN_RATIO * fabs(dy));
+	const bool y_runs = (fabs(dy) >= RUN_RATIO * fabs(dx));
+
+	// Bitmap row of the current tile, and offset between rows along the ray
+	const uint64_t* row = &occupancy[(cur_tile_y + 1) * occupancy_row_words];
+	const int row_step = dy_step * occupancy_row_words;
+
+	float t = 0;
+
+	while (t < length)
+	{
+		// Inside a rectangle of open tiles, jump straight to the first tile past it
+		tile_rect_t empty;
+
+		if (getEmptyRect(cur_tile_x, cur_tile_y, distance_field, &empty))
+		{
+			// Steps along each axis to the first tile outside the rectangle
+			const int exit_steps_x = (dx_step > 0 ? empty.x_end - cur_tile_x : cur_tile_x - empty.x_begin + 1);
+			const int exit_steps_y = (dy_step > 0 ? empty.y_end - cur_tile_y : cur_tile_y - empty.y_begin + 1);
+
+			const float exit_tx = crossingTime(cur_tile_x + exit_steps_x * dx_step, dx_coeff, dx_bias);
+			const float exit_ty = crossingTime(cur_tile_y + exit_steps_y * dy_step, dy_coeff, dy_bias);
+
+			// The ray leaves through the side it crosses first, after every step along
+			// the other axis that comes before, with ties stepping along y as below
+			const bool exits_x = (exit_tx < exit_ty);
+
+			const int steps_x = (exits_x ? exit_steps_x : countSteps(cur_tile_x, dx_step, dx_coeff, dx, dx_bias, exit_ty, false));
+			const int steps_y = (exits_x ? countSteps(cur_tile_y, dy_step, dy_coeff, dy, dy_bias, exit_tx, true) : exit_steps_y);
+
+			// If the last step inside the rectangle reaches the end of the ray then the
+			// loop would have stopped there without a hit
+			const int inside_x = steps_x - (exits_x ? 1 : 0);
+			const int inside_y = steps_y - (exits_x ? 0 : 1);
+
+			float last_t = t;
+
+			if (inside_x > 0)
+				last_t = std::max(last_t, crossingTime(cur_tile_x + inside_x * dx_step, dx_coeff, dx_bias));
+			if (inside_y > 0)
+				last_t = std::max(last_t, crossingTime(cur_tile_y + inside_y * dy_step, dy_coeff, dy_bias));
+
+			if (!(last_t < length))
+			{
+				return false;
+			}
+
+			cur_tile_x += steps_x * dx_step;
+			cur_tile_y += steps_y * dy_step;
+			row += steps_y * row_step;
+			t = (exits_x ? exit_tx : exit_ty);
+
+			if ((row[(cur_tile_x + 1) >> 6] >> ((cur_tile_x + 1) & 63)) & 1)
+			{
+				return true;
+			}
+
+			continue;
+		}
+
+		int next_x = cur_tile_x + dx_step;
+		int next_y = cur_tile_y + dy_step;
+
+		// Calculate next tx and ty value
+		float tx = crossingTime(next_x, dx_coeff, dx_bias);
+		float ty = crossingTime(next_y, dy_coeff, dy_bias);
+
+		if (tx < ty)
+		{
+			if (x_runs)
+			{
+				// Keep stepping along x until the ray reaches the next row, or a
+				// step starts past the end of the ray
+				int steps = countSteps(cur_tile_x, dx_step, dx_coeff, dx, dx_bias, ty, false);
+
+				if (steps > 1 && !(crossingTime(cur_tile_x + (steps - 1) * dx_step, dx_coeff, dx_bias) < length))
+					steps = countSteps(cur_tile_x, dx_step, dx_coeff, dx, dx_bias, length, false) + 1;
+
+				int last_x = cur_tile_x + steps * dx_step;
+
+				// Check the whole run in the row bitmap
+				if (anyBitSet(row, (dx_step > 0 ? next_x : last_x) + 1, (dx_step > 0 ? last_x : next_x) + 1))
+				{
+					return true;
+				}
+
+				cur_tile_x = last_x;
+				t = crossingTime(last_x, dx_coeff, dx_bias);
+
+				continue;
+			}
+
+			cur_tile_x = next_x;
+			t = tx;
+		}
+		else
+		{
+			if (y_runs)
+			{
+				// As above, but along y using the column bitmap, and ties step along y
+				int steps = countSteps(cur_tile_y, dy_step, dy_coeff, dy, dy_bias, tx, true);
+
+				if (steps > 1 && !(crossingTime(cur_tile_y + (steps - 1) * dy_step, dy_coeff, dy_bias) < length))
+					steps = countSteps(cur_tile_y, dy_step, dy_coeff, dy, dy_bias, length, false) + 1;
+
+				int last_y = cur_tile_y + steps * dy_step;
+
+				const uint64_t* column = &occupancy_transposed[(cur_tile_x + 1) * occupancy_column_words];
+
+				if (anyBitSet(column, (dy_step > 0 ? next_y : last_y) + 1, (dy_step > 0 ? last_y : next_y) + 1))
+				{
+					return true;
+				}
+
+				cur_tile_y = last_y;
+				row += steps * row_step;
+				t = crossingTime(last_y, dy_coeff, dy_bias);
+
+				continue;
+			}
+
+			cur_tile_y = next_y;
+			row += row_step;
+			t = ty;
+		}
+
+		// If tile blocked, return true (hit)
+		if ((row[(cur_tile_x + 1) >> 6] >> ((cur_tile_x + 1) & 63)) & 1)
+		{
+			return true;
+		}
+	}
+
+	// Made it to (endx, endy), return false (hit)
+	return false;
+}
+
+bool raycast(int startx, int starty, int endx, int endy)
+{
+	return castRay(startx, starty, endx, endy, false);
+}
+
+bool raycastDistanceField(int startx, int starty, int endx, int endy)
+{
+	// Without wall distances the pyramid gives the same tiles
+	return castRay(startx, starty, endx, endy, wall_distance != nullptr);
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Level width, height, and buffer, the buffer is null for a streamed level
+extern int level_width;
+extern int level_height;
+extern char* level;
+
+// Tiles are stored in chunks of LEVEL_CHUNK_SIZE x LEVEL_CHUNK_SIZE tiles, row
+// by row in each chunk, so nearby tiles in any direction are close in memory
+// The chunks of each LEVEL_CHUNK_GROUP x LEVEL_CHUNK_GROUP group are in Morton
+// (Z) order, and the groups row by row, so the last group in each row and
+// column is padded out with walls
+const int LEVEL_CHUNK_SHIFT = 5;
+const int LEVEL_CHUNK_SIZE = 1 << LEVEL_CHUNK_SHIFT;
+const int LEVEL_CHUNK_TILES = LEVEL_CHUNK_SIZE * LEVEL_CHUNK_SIZE;
+const int LEVEL_CHUNK_GROUP_SHIFT = 2;
+const int LEVEL_CHUNK_GROUP = 1 << LEVEL_CHUNK_GROUP_SHIFT;
+
+// Groups of chunks in each row of a level of the given width
+inline int getChunkGroupColumns(int width)
+{
+	return (width + LEVEL_CHUNK_SIZE * LEVEL_CHUNK_GROUP - 1) >> (LEVEL_CHUNK_SHIFT + LEVEL_CHUNK_GROUP_SHIFT);
+}
+
+// Index of chunk (chunk_x, chunk_y) in a layout with group_columns groups per row
+inline size_t getChunkIndex(int chunk_x, int chunk_y, int group_columns)
+{
+	const int group = (chunk_y >> LEVEL_CHUNK_GROUP_SHIFT) * group_columns + (chunk_x >> LEVEL_CHUNK_GROUP_SHIFT);
+
+	// Interleave the two bits of each coordinate within the group
+	const int morton = (chunk_x & 1) | ((chunk_y & 1) << 1) | ((chunk_x & 2) << 1) | ((chunk_y & 2) << 2);
+
+	return ((size_t)group << (2 * LEVEL_CHUNK_GROUP_SHIFT)) | morton;
+}
+
+// Index into a buffer of the given level width of tile (x, y)
+inline size_t getTileIndex(int x, int y, int width)
+{
+	return (getChunkIndex(x >> LEVEL_CHUNK_SHIFT, y >> LEVEL_CHUNK_SHIFT, getChunkGroupColumns(width)) << (2 * LEVEL_CHUNK_SHIFT)) |
+		((y & (LEVEL_CHUNK_SIZE - 1)) << LEVEL_CHUNK_SHIFT) | (x & (LEVEL_CHUNK_SIZE - 1));
+}
+
+inline size_t getTileIndex(int x, int y)
+{
+	return getTileIndex(x, y, level_width);
+}
+
+// The tiles of each chunk in chunk order, into the level buffer for a level
+// loaded whole, or into the chunk cache for a streamed one, where the chunks
+// that aren't in memory are null
+extern char** level_chunks;
+
+// Returns true if the chunk over tile (x, y) is in memory
+inline bool isTileLoaded(int x, int y)
+{
+	return level_chunks[getTileIndex(x, y) >> (2 * LEVEL_CHUNK_SHIFT)] != nullptr;
+}
+
+// Returns a pointer to the tile at (x, y), whose chunk must be in memory, the
+// rest of its row in the chunk follows it
+inline char* getTilePointer(int x, int y)
+{
+	const size_t index = getTileIndex(x, y);
+
+	return &level_chunks[index >> (2 * LEVEL_CHUNK_SHIFT)][index & (LEVEL_CHUNK_TILES - 1)];
+}
+
+// Returns the tile at (x, y), which must be in the level and in memory
+inline char getTile(int x, int y)
+{
+	return *getTilePointer(x, y);
+}
+
+// Size in bytes of the buffer for a level, including the padding
+inline size_t getLevelStorageSize(int width, int height)
+{
+	const size_t group_size = (size_t)LEVEL_CHUNK_SIZE * LEVEL_CHUNK_GROUP;
+
+	return ((width + group_size - 1) / group_size) * ((height + group_size - 1) / group_size) * group_size * group_size;
+}
+
+// Allocates a buffer for a level, every tile and the padding set to walls
+char* allocateLevel(int width, int height);
+
+// Sizes level_chunks for the level, pointing it into the level buffer, or all
+// null for a streamed level, call after loading it
+void buildLevelChunks();
+void freeLevelChunks();
+
+// A rectangle of tiles from (x_begin, y_begin) up to but not including (x_end, y_end)
+struct tile_rect_t
+{
+	int x_begin;
+	int y_begin;
+	int x_end;
+	int y_end;
+};
+
+inline tile_rect_t getLevelRect()
+{
+	return tile_rect_t{ 0, 0, level_width, level_height };
+}
+
+inline tile_rect_t intersectRects(const tile_rect_t& a, const tile_rect_t& b)
+{
+	return tile_rect_t{ (a.x_begin > b.x_begin ? a.x_begin : b.x_begin), (a.y_begin > b.y_begin ? a.y_begin : b.y_begin),
+		(a.x_end < b.x_end ? a.x_end : b.x_end), (a.y_end < b.y_end ? a.y_end : b.y_end) };
+}
+
+inline bool isRectEmpty(const tile_rect_t& rect)
+{
+	return (rect.x_begin >= rect.x_end || rect.y_begin >= rect.y_end);
+}
+
+inline bool isInRect(const tile_rect_t& rect, int x, int y)
+{
+	return (x >= rect.x_begin && y >= rect.y_begin && x < rect.x_end && y < rect.y_end);
+}
+
+inline bool areRectsEqual(const tile_rect_t& a, const tile_rect_t& b)
+{
+	return (a.x_begin == b.x_begin && a.y_begin == b.y_begin && a.x_end == b.x_end && a.y_end == b.y_end);
+}
+
+// Grows a rectangle by margin tiles on every side
+inline tile_rect_t expandRect(const tile_rect_t& rect, int margin)
+{
+	return tile_rect_t{ rect.x_begin - margin, rect.y_begin - margin, rect.x_end + margin, rect.y_end + margin };
+}
+
+// Wall occupancy, one bit per tile packed into 64-bit words
+// Both copies have a one tile border of walls around the level, the rows are
+// stored in occupancy and the columns in occupancy_transposed, so that a run of
+// tiles along either axis is a run of bits in consecutive words
+extern uint64_t* occupancy;
+extern uint64_t* occupancy_transposed;
+extern int occupancy_row_words;
+extern int occupancy_column_words;
+
+// Occupancy pyramid, level k has a byte per 2^k x 2^k block of tiles that is
+// set if any tile in the block is a wall, from 2 x 2 blocks up to 64 x 64
+// Blocks that run off the edge of the level count as walls
+const int OCCUPANCY_PYRAMID_LEVELS = 6;
+
+extern uint8_t* occupancy_pyramid[OCCUPANCY_PYRAMID_LEVELS + 1];
+extern int occupancy_pyramid_width[OCCUPANCY_PYRAMID_LEVELS + 1];
+
+// Returns true if the block at pyramid level k containing tile (x, y) has a wall, for a tile in the level
+inline bool isBlockOccupied(int k, int x, int y)
+{
+	return occupancy_pyramid[k][(y >> k) * occupancy_pyramid_width[k] + (x >> k)] != 0;
+}
+
+// Chebyshev distance from each tile to the nearest wall, so every tile less
+// than this far from it along both axes is open, 0 for walls
+// Tiles outside the level count as walls, and distances stop at MAX_WALL_DISTANCE
+// A streamed level has none, as they would take as much memory as its tiles
+const int MAX_WALL_DISTANCE = 255;
+
+extern uint8_t* wall_distance;
+
+// Returns the wall distance of a tile, 0 outside the level or with no distances
+inline int getWallDistance(int x, int y)
+{
+	if (wall_distance == nullptr || x < 0 || y < 0 || x >= level_width || y >= level_height)
+		return 0;
+
+	return wall_distance[y * level_width + x];
+}
+
+// Builds the occupancy bitmaps, pyramid and wall distances from the level, call after loading it
+// Tiles of chunks that aren't in memory count as walls until updateLevelChunk()
+void buildOccupancy();
+void freeOccupancy();
+
+// Brings the occupancy bitmaps, pyramid and wall segments up to date with a
+// chunk of a streamed level the first time it is loaded
+void updateLevelChunk(int chunk_x, int chunk_y);
+
+// Changes a tile and keeps the occupancy bitmaps up to date, the pyramid by
+// redoing the one block over the tile at each level, and the wall distances
+// by redoing the square of tiles around it that they can change in
+void setLevelTile(int x, int y, char tile);
+
+// Returns true if the tile is a wall, x and y can be one tile outside the level
+inline bool isOccupied(int x, int y)
+{
+	return ((occupancy[(y + 1) * occupancy_row_words + ((x + 1) >> 6)] >> ((x + 1) & 63)) & 1) != 0;
+}
+
+// Return true if tiles first to last (inclusive) along a row or column are all
+// open or all walls, tiles outside the level count as walls
+bool isRowOpen(int y, int x_first, int x_last);
+bool isRowWall(int y, int x_first, int x_last);
+bool isColumnWall(int x, int y_first, int y_last);
+
+// Returns true if the tile is a wall, tiles outside the level count as walls
+inline bool isWall(int x, int y)
+{
+	if (x < 0 || y < 0 || x >= level_width || y >= level_height)
+		return true;
+
+	return isOccupied(x, y);
+}
+
+// A boundary between wall and open tiles along a grid line, from corner
+// (x_begin, y_begin) to corner (x_end, y_end), either horizontal or vertical
+// Tiles outside the level count as walls, so open tiles on the edge of the level are bounded too
+struct wall_segment_t
+{
+	int x_begin;
+	int y_begin;
+	int x_end;
+	int y_end;
+};
+
+// Wall segments on each grid line, horizontal_segments[y] along the top edge of row y and
+// vertical_segments[x] along the left edge of column x, each sorted and with collinear runs
+// merged as long as the wall stays on the same side
+extern std::vector<std::vector<wall_segment_t>> horizontal_segments;
+extern std::vector<std::vector<wall_segment_t>> vertical_segments;
+
+// Builds the wall segments from the level, call after loading it
+// setLevelTile() keeps them up to date by rebuilding the four lines around the tile
+void buildWallSegments();
+int getWallSegmentCount();
+
+// Appends the wall segments that cross rect, clipped to it
+void getWallSegments(const tile_rect_t& rect, std::vector<wall_segment_t>* segments);
+
+// Returns true if a wall blocks the ray from tile (startx, starty) to (endx, endy)
+// Crosses empty pyramid blocks in one step, landing on the same tile at the
+// same time as stepping through them tile by tile would
+bool raycast(int startx, int starty, int endx, int endy);
+
+// As raycast() with the same result, but jumps across the square of open
+// tiles given by the wall distance of each tile it reaches instead, stepping
+// a tile at a time only next to walls
+bool raycastDistanceField(int startx, int starty, int endx, int endy);
+
+// Casts from one start tile to eight end tiles, bit i of the result is set if
+// raycast() to (endx[i], endy[i]) would hit, uses AVX2 when available
+uint8_t raycast8(int startx, int starty, const int* endx, const int* endy);
@@ -0,0 +1,364 @@
+#include "levelfile.h"
+#include "level.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The mapping the level buffer points into, if it was mapped
+static void* mapped_file = nullptr;
+static size_t mapped_size = 0;
+
+bool isLevelFile(const char* filename)
+{
+	FILE* file = fopen(filename, "rb");
+
+	if (file == nullptr)
+		return false;
+
+	char magic[sizeof(LEVEL_FILE_MAGIC)];
+
+	const bool is_level = (fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+		memcmp(magic, LEVEL_FILE_MAGIC, sizeof(magic)) == 0);
+
+	fclose(file);
+
+	return is_level;
+}
+
+// Maps a whole file copy on write, returns false if it can't be
+// An empty file can't be mapped, and gives a size of 0 and no data
+static bool mapFile(const char* filename, void** data, size_t* size)
+{
+	*data = nullptr;
+	*size = 0;
+
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	bool ok = false;
+
+	if (GetFileSizeEx(file, &file_size))
+	{
+		*size = (size_t)file_size.QuadPart;
+		ok = (*size == 0);
+
+		HANDLE mapping = (ok ? nullptr : CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr));
+
+		if (mapping != nullptr)
+		{
+			*data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+			ok = (*data != nullptr);
+
+			// The view keeps the mapping open
+			CloseHandle(mapping);
+		}
+	}
+
+	CloseHandle(file);
+
+	return ok;
+#else
+	int file = open(filename, O_RDONLY);
+
+	if (file < 0)
+		return false;
+
+	struct stat status;
+	bool ok = false;
+
+	if (fstat(file, &status) == 0)
+	{
+		*size = (size_t)status.st_size;
+		ok = (*size == 0);
+
+		if (!ok)
+		{
+			*data = mmap(nullptr, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+			ok = (*data != MAP_FAILED);
+
+			if (!ok)
+				*data = nullptr;
+		}
+	}
+
+	// The mapping keeps the file open
+	close(file);
+
+	return ok;
+#endif
+}
+
+static void unmapFile(void* data, size_t size)
+{
+#if defined(_WIN32)
+	UnmapViewOfFile(data);
+#else
+	munmap(data, size);
+#endif
+}
+
+const char* checkLevelFileHeader(const level_file_header_t& header, size_t size)
+{
+	if (memcmp(header.magic, LEVEL_FILE_MAGIC, sizeof(LEVEL_FILE_MAGIC)) != 0)
+		return "not a level file";
+
+	if (header.version != LEVEL_FILE_VERSION)
+		return "unknown version";
+
+	if (header.chunk_size != 0 && header.chunk_size != LEVEL_CHUNK_SIZE)
+		return "unsupported chunk size";
+
+	if (header.width == 0 || header.height == 0 || header.width > 65536 || header.height > 65536)
+		return "bad dimensions";
+
+	if (header.data_offset < sizeof(level_file_header_t) ||
+		size < header.data_offset + (header.chunk_size != 0 ? getLevelStorageSize(header.width, header.height) :
+		(size_t)header.width * header.height))
+	{
+		return "truncated";
+	}
+
+	return nullptr;
+}
+
+bool mapLevelFile(const char* filename, char** level, int* level_width, int* level_height)
+{
+	size_t size = 0;
+	void* data = nullptr;
+
+	if (!mapFile(filename, &data, &size) || data == nullptr)
+	{
+		fprintf(stderr, "Failed to map file: %s\n", filename);
+		return false;
+	}
+
+	const level_file_header_t* header = (const level_file_header_t*)data;
+
+	const char* error = (size < sizeof(level_file_header_t) ? "not a level file" : checkLevelFileHeader(*header, size));
+
+	if (error != nullptr)
+	{
+		fprintf(stderr, "Bad level file %s: %s\n", filename, error);
+
+		unmapFile(data, size);
+		return false;
+	}
+
+	freeLevel(*level);
+
+	const int width = (int)header->width;
+	const int height = (int)header->height;
+	const bool chunked = (header->chunk_size != 0);
+
+	if (!chunked)
+	{
+		// Row by row tiles are copied into chunks, and the file isn't kept mapped
+		char* tiles = allocateLevel(width, height);
+		const char* rows = (const char*)data + header->data_offset;
+
+		for (int y = 0; y < height; ++y)
+		{
+			for (int x = 0; x < width; x += LEVEL_CHUNK_SIZE)
+				memcpy(&tiles[getTileIndex(x, y, width)], &rows[(size_t)y * width + x], std::min(LEVEL_CHUNK_SIZE, width - x));
+		}
+
+		unmapFile(data, size);
+
+		*level = tiles;
+	}
+	else
+	{
+		mapped_file = data;
+		mapped_size = size;
+
+		*level = (char*)data + header->data_offset;
+	}
+
+	*level_width = width;
+	*level_height = height;
+
+	printf("Level height: %d, level width: %d%s\n", height, width, (chunked ? " (mapped)" : ""));
+
+	return true;
+}
+
+bool readTextLevel(const char* filename, char** level, int* level_width, int* level_height)
+{
+	size_t size = 0;
+	void* data = nullptr;
+
+	if (!mapFile(filename, &data, &size))
+	{
+		fprintf(stderr, "Failed to open file for reading: %s\n", filename);
+		return false;
+	}
+
+	const char* text = (const char*)data;
+	const char* end = text + size;
+
+	// The first row gives the width, and as every row but the last ends in a
+	// newline there can't be more rows than fit in the file at that width
+	const char* newline = (const char*)memchr(text, '\n', size);
+	const char* first_end = (newline != nullptr ? newline : end);
+
+	if (first_end > text && first_end[-1] == '\r')
+		first_end--;
+
+	const size_t width = first_end - text;
+
+	if (width == 0)
+	{
+		if (size != 0)
+		{
+			fprintf(stderr, "First row of %s is empty\n", filename);
+
+			unmapFile(data, size);
+			return false;
+		}
+
+		// An empty file is an empty level
+		freeLevel(*level);
+
+		*level = nullptr;
+		*level_width = 0;
+		*level_height = 0;
+
+		return true;
+	}
+
+	const size_t max_height = size / (width + 1) + 1;
+
+	// Rows are only added at the end of the layout, so the level is laid out the
+	// same whatever its height
+	char* tiles = allocateLevel((int)width, (int)max_height);
+	size_t height = 0;
+
+	for (const char* row = text; row < end;)
+	{
+		newline = (const char*)memchr(row, '\n', end - row);
+
+		const char* row_end = (newline != nullptr ? newline : end);
+
+		size_t length = row_end - row;
+
+		if (length > 0 && row[length - 1] == '\r')
+			length--;
+
+		if (length != width)
+		{
+			fprintf(stderr, "Row %d of %s is %d tiles wide, the first row is %d\n",
+				(int)height + 1, filename, (int)length, (int)width);
+
+			delete[] tiles;
+			unmapFile(data, size);
+			return false;
+		}
+
+		for (size_t x = 0; x < width; x += LEVEL_CHUNK_SIZE)
+			memcpy(&tiles[getTileIndex((int)x, (int)height, (int)width)], &row[x], std::min((size_t)LEVEL_CHUNK_SIZE, width - x));
+
+		height++;
+
+		row = (newline != nullptr ? newline + 1 : end);
+	}
+
+	unmapFile(data, size);
+
+	freeLevel(*level);
+
+	*level = tiles;
+	*level_width = (int)width;
+	*level_height = (int)height;
+
+	printf("Level height: %d, level width: %d\n", *level_height, *level_width);
+
+	return true;
+}
+
+bool writeLevelFile(const char* filename, const char* level, int level_width, int level_height)
+{
+	level_file_header_t header;
+	memset(&header, 0, sizeof(header));
+
+	memcpy(header.magic, LEVEL_FILE_MAGIC, sizeof(LEVEL_FILE_MAGIC));
+	header.version = LEVEL_FILE_VERSION;
+	header.width = (uint32_t)level_width;
+	header.height = (uint32_t)level_height;
+	header.chunk_size = LEVEL_CHUNK_SIZE;
+	header.data_offset = LEVEL_FILE_DATA_OFFSET;
+
+	// Note the tiles used, at most one of each of the 256 byte values, in row
+	// order rather than the order they are stored in
+	bool used[256] = {};
+
+	for (int y = 0; y < level_height; ++y)
+	{
+		for (int x = 0; x < level_width; ++x)
+		{
+			const uint8_t tile = (uint8_t)level[getTileIndex(x, y, level_width)];
+
+			if (!used[tile])
+			{
+				used[tile] = true;
+				header.palette[header.palette_size++] = (char)tile;
+			}
+		}
+	}
+
+	const size_t size = getLevelStorageSize(level_width, level_height);
+
+	FILE* file = fopen(filename, "wb");
+
+	if (file == nullptr)
+	{
+		fprintf(stderr, "Failed to open file for writing: %s\n", filename);
+		return false;
+	}
+
+	// The header, padded out to the tiles
+	static const char padding[LEVEL_FILE_DATA_OFFSET] = {};
+
+	bool ok = (fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(padding, 1, LEVEL_FILE_DATA_OFFSET - sizeof(header), file) == LEVEL_FILE_DATA_OFFSET - sizeof(header) &&
+		fwrite(level, 1, size, file) == size);
+
+	if (fclose(file) != 0)
+		ok = false;
+
+	if (!ok)
+		fprintf(stderr, "Failed to write file: %s\n", filename);
+
+	return ok;
+}
+
+void freeLevel(char* level)
+{
+	if (mapped_file != nullptr && level == (char*)mapped_file + ((const level_file_header_t*)mapped_file)->data_offset)
+	{
+		unmapFile(mapped_file, mapped_size);
+
+		mapped_file = nullptr;
+		mapped_size = 0;
+	}
+	else
+	{
+		delete[] level;
+	}
+}
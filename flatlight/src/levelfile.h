@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary level files, a header followed by one byte per tile laid out in
+// chunks the same as the level buffer, padding included, so the tiles are
+// memory mapped and used as the level buffer in place
+// Files with the tiles row by row are still read, into a buffer
+// Tiles are mapped copy on write, so the pages stay in the page cache until a
+// tile on them is changed
+const char LEVEL_FILE_MAGIC[4] = { 'F', 'L', 'V', 'L' };
+const uint32_t LEVEL_FILE_VERSION = 1;
+
+// The tiles start this far into the file, a page boundary
+const uint32_t LEVEL_FILE_DATA_OFFSET = 4096;
+
+struct level_file_header_t
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+
+	// Width and height of the chunks the tiles are stored in, 0 for row by row
+	uint32_t chunk_size;
+
+	// The distinct tiles in the level, in the order they first appear
+	uint32_t palette_size;
+	char palette[256];
+
+	// Offset of the tiles from the start of the file
+	uint32_t data_offset;
+};
+
+// Returns true if the file starts with LEVEL_FILE_MAGIC
+bool isLevelFile(const char* filename);
+
+// Returns why a binary level file of size bytes with this header can't be
+// used, or null if it can
+const char* checkLevelFileHeader(const level_file_header_t& header, size_t size);
+
+// Maps a binary level file, returns false and prints why if it can't be
+// mapped or isn't a valid level file
+bool mapLevelFile(const char* filename, char** level, int* level_width, int* level_height);
+
+// Reads a text level file, one row of tiles per line, in a single pass over
+// the mapped file with no limit on the width, LF or CRLF line endings
+// Returns false and prints the row if the rows aren't all as wide as the first
+bool readTextLevel(const char* filename, char** level, int* level_width, int* level_height);
+
+// Writes a level to a binary level file, returns false if it can't be written
+bool writeLevelFile(const char* filename, const char* level, int level_width, int level_height);
+
+// Frees a level loaded by either loader, unmapping it if it was mapped
+void freeLevel(char* level);
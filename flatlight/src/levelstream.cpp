@@ -0,0 +1,503 @@
+#include "levelstream.h"
+
+#include "levelfile.h"
+#include "lightmanager.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/types.h>
+#endif
+
+size_t level_stream_budget = DEFAULT_LEVEL_STREAM_BUDGET;
+
+enum
+{
+	CHUNK_UNLOADED,
+	CHUNK_LOADING,
+	CHUNK_LOADED
+};
+
+// What the cache knows of a chunk of the level
+struct stream_chunk_t
+{
+	uint8_t state;
+
+	// Loaded before, so the occupancy bitmaps already have its tiles
+	bool seen;
+
+	// Has changed tiles, so it is never dropped
+	bool changed;
+
+	// Frames it was last requested in, and last requested or prefetched in
+	uint32_t last_requested;
+	uint32_t last_wanted;
+
+	// Place in lru_chunks while it is loaded and unchanged
+	std::list<size_t>::iterator lru_position;
+};
+
+// A chunk for the I/O thread to read, and the buffer it goes in
+struct chunk_load_t
+{
+	size_t chunk;
+	int chunk_x;
+	int chunk_y;
+	char* tiles;
+};
+
+// The level file, only read by the I/O thread once it is open
+static FILE* stream_file = nullptr;
+static std::string stream_filename;
+static uint32_t stream_data_offset;
+
+static std::vector<stream_chunk_t> stream_chunks;
+
+// Loaded chunks that can be dropped, the one that went longest without being wanted first
+static std::list<size_t> lru_chunks;
+
+// Chunk buffers, every one allocated and the ones not holding a chunk, and the
+// most there can be in the budget
+static std::vector<char*> chunk_buffers;
+static std::vector<char*> free_buffers;
+static size_t max_chunk_buffers;
+
+// Frames counted by updateLevelStream(), the last one a request found every
+// loaded chunk in use, and whether any request went without a load in this one
+static uint32_t stream_frame = 0;
+static uint32_t stream_full_frame = 0;
+static bool stream_waiting = false;
+
+// Loads waiting for the I/O thread, requested ones at the front, and loads
+// it has finished, both guarded by io_mutex
+static std::thread io_thread;
+static std::mutex io_mutex;
+static std::condition_variable io_start_condition;
+static std::condition_variable io_done_condition;
+static std::deque<chunk_load_t> queued_loads;
+static std::vector<chunk_load_t> finished_loads;
+static int loads_in_flight = 0;
+static bool io_stopping = false;
+
+// Reused list of loads put into the level by updateLevelStream()
+static std::vector<chunk_load_t> installing_loads;
+
+static bool seekFile(FILE* file, uint64_t offset, int origin)
+{
+#if defined(_WIN32)
+	return (_fseeki64(file, (int64_t)offset, origin) == 0);
+#else
+	return (fseeko(file, (off_t)offset, origin) == 0);
+#endif
+}
+
+static uint64_t tellFile(FILE* file)
+{
+#if defined(_WIN32)
+	return (uint64_t)_ftelli64(file);
+#else
+	return (uint64_t)ftello(file);
+#endif
+}
+
+static bool readChunk(size_t chunk, char* tiles)
+{
+	return (seekFile(stream_file, stream_data_offset + (uint64_t)chunk * LEVEL_CHUNK_TILES, SEEK_SET) &&
+		fread(tiles, 1, LEVEL_CHUNK_TILES, stream_file) == LEVEL_CHUNK_TILES);
+}
+
+// Reads chunks off the queue until the stream is closed
+static void ioThread()
+{
+	std::unique_lock<std::mutex> lock(io_mutex);
+
+	while (true)
+	{
+		io_start_condition.wait(lock, [] { return io_stopping || !queued_loads.empty(); });
+
+		if (io_stopping)
+			return;
+
+		chunk_load_t load = queued_loads.front();
+		queued_loads.pop_front();
+
+		lock.unlock();
+
+		// A chunk that can't be read is all walls, so the lights waiting on it still get lit
+		if (!readChunk(load.chunk, load.tiles))
+		{
+			fprintf(stderr, "Failed to read chunk (%d, %d) of %s\n", load.chunk_x, load.chunk_y, stream_filename.c_str());
+
+			memset(load.tiles, '#', LEVEL_CHUNK_TILES);
+		}
+
+		lock.lock();
+
+		finished_loads.push_back(load);
+		loads_in_flight--;
+
+		io_done_condition.notify_all();
+	}
+}
+
+bool openLevelStream(const char* filename)
+{
+	FILE* file = fopen(filename, "rb");
+
+	if (file == nullptr)
+	{
+		fprintf(stderr, "Failed to open file for reading: %s\n", filename);
+		return false;
+	}
+
+	level_file_header_t header;
+
+	const bool read = (fread(&header, sizeof(header), 1, file) == 1 && seekFile(file, 0, SEEK_END));
+	const char* error = (read ? checkLevelFileHeader(header, (size_t)tellFile(file)) : "not a level file");
+
+	if (error == nullptr && header.chunk_size == 0)
+		error = "its tiles are row by row, convert it again to stream it";
+
+	if (error != nullptr)
+	{
+		fprintf(stderr, "Bad level file %s: %s\n", filename, error);
+
+		fclose(file);
+		return false;
+	}
+
+	closeLevelStream();
+
+	stream_file = file;
+	stream_filename = filename;
+	stream_data_offset = header.data_offset;
+
+	level = nullptr;
+	level_width = (int)header.width;
+	level_height = (int)header.height;
+
+	stream_chunk_t unloaded;
+	unloaded.state = CHUNK_UNLOADED;
+	unloaded.seen = false;
+	unloaded.changed = false;
+	unloaded.last_requested = 0;
+	unloaded.last_wanted = 0;
+
+	stream_chunks.assign(getLevelStorageSize(level_width, level_height) / LEVEL_CHUNK_TILES, unloaded);
+
+	max_chunk_buffers = std::max(level_stream_budget / LEVEL_CHUNK_TILES, (size_t)1);
+
+	// Frame 0 is never current, so nothing starts out requested
+	stream_frame = 1;
+	stream_full_frame = 0;
+	stream_waiting = false;
+
+	io_stopping = false;
+	io_thread = std::thread(ioThread);
+
+	printf("Level height: %d, level width: %d (streamed, %d KB of chunks)\n", level_height, level_width,
+		(int)(max_chunk_buffers * LEVEL_CHUNK_TILES >> 10));
+
+	return true;
+}
+
+void closeLevelStream()
+{
+	if (stream_file == nullptr)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(io_mutex);
+		io_stopping = true;
+	}
+
+	io_start_condition.notify_all();
+	io_thread.join();
+
+	fclose(stream_file);
+	stream_file = nullptr;
+
+	queued_loads.clear();
+	finished_loads.clear();
+	loads_in_flight = 0;
+
+	for (size_t i = 0; i < chunk_buffers.size(); ++i)
+		delete[] chunk_buffers[i];
+
+	std::vector<char*>().swap(chunk_buffers);
+	std::vector<char*>().swap(free_buffers);
+	std::vector<stream_chunk_t>().swap(stream_chunks);
+
+	lru_chunks.clear();
+}
+
+bool isLevelStreamed()
+{
+	return (stream_file != nullptr);
+}
+
+bool updateLevelStream()
+{
+	if (stream_file == nullptr)
+		return false;
+
+	stream_frame++;
+	stream_waiting = false;
+
+	{
+		std::lock_guard<std::mutex> lock(io_mutex);
+		installing_loads.swap(finished_loads);
+	}
+
+	for (size_t i = 0; i < installing_loads.size(); ++i)
+	{
+		const chunk_load_t& load = installing_loads[i];
+		stream_chunk_t& chunk = stream_chunks[load.chunk];
+
+		level_chunks[load.chunk] = load.tiles;
+
+		chunk.state = CHUNK_LOADED;
+		chunk.lru_position = lru_chunks.insert(lru_chunks.end(), load.chunk);
+
+		if (!chunk.seen)
+		{
+			chunk.seen = true;
+			updateLevelChunk(load.chunk_x, load.chunk_y);
+		}
+	}
+
+	const bool installed = !installing_loads.empty();
+
+	installing_loads.clear();
+
+	return installed;
+}
+
+// Returns a buffer for a chunk to be read into, dropping the loaded chunk that
+// went longest without being wanted if the cache is full, or null if there is
+// none to drop: for a request every loaded chunk was requested in this frame,
+// and for a prefetch every one was wanted in it
+static char* getChunkBuffer(bool prefetch)
+{
+	if (!free_buffers.empty())
+	{
+		char* tiles = free_buffers.back();
+		free_buffers.pop_back();
+
+		return tiles;
+	}
+
+	if (chunk_buffers.size() < max_chunk_buffers)
+	{
+		chunk_buffers.push_back(new char[LEVEL_CHUNK_TILES]);
+		return chunk_buffers.back();
+	}
+
+	if (stream_full_frame == stream_frame)
+		return nullptr;
+
+	auto it = lru_chunks.begin();
+
+	if (prefetch)
+	{
+		// Chunks move to the back as they are wanted, so if the first was wanted
+		// in this frame they all were
+		if (it == lru_chunks.end() || stream_chunks[*it].last_wanted == stream_frame)
+			return nullptr;
+	}
+	else
+	{
+		while (it != lru_chunks.end() && stream_chunks[*it].last_requested == stream_frame)
+			++it;
+
+		if (it == lru_chunks.end())
+		{
+			// Nothing requested later in the frame can be dropped either
+			stream_full_frame = stream_frame;
+			return nullptr;
+		}
+	}
+
+	const size_t index = *it;
+
+	lru_chunks.erase(it);
+	stream_chunks[index].state = CHUNK_UNLOADED;
+
+	char* tiles = level_chunks[index];
+	level_chunks[index] = nullptr;
+
+	return tiles;
+}
+
+// Hands a chunk to the I/O thread, returns false if there was no room for it
+static bool startLoad(size_t index, int chunk_x, int chunk_y, bool prefetch)
+{
+	char* tiles = getChunkBuffer(prefetch);
+
+	if (tiles == nullptr)
+		return false;
+
+	stream_chunks[index].state = CHUNK_LOADING;
+
+	{
+		std::lock_guard<std::mutex> lock(io_mutex);
+
+		const chunk_load_t load{ index, chunk_x, chunk_y, tiles };
+
+		if (prefetch)
+			queued_loads.push_back(load);
+		else
+			queued_loads.push_front(load);
+
+		loads_in_flight++;
+	}
+
+	io_start_condition.notify_one();
+
+	return true;
+}
+
+// Calls visit(index, chunk_x, chunk_y) for each chunk over rect in the level,
+// stopping if it returns false
+template <typename visit_t>
+static void forEachChunk(const tile_rect_t& rect, visit_t visit)
+{
+	const tile_rect_t tiles = intersectRects(rect, getLevelRect());
+
+	if (isRectEmpty(tiles))
+		return;
+
+	const int group_columns = getChunkGroupColumns(level_width);
+
+	for (int chunk_y = tiles.y_begin >> LEVEL_CHUNK_SHIFT; chunk_y <= (tiles.y_end - 1) >> LEVEL_CHUNK_SHIFT; ++chunk_y)
+	{
+		for (int chunk_x = tiles.x_begin >> LEVEL_CHUNK_SHIFT; chunk_x <= (tiles.x_end - 1) >> LEVEL_CHUNK_SHIFT; ++chunk_x)
+		{
+			if (!visit(getChunkIndex(chunk_x, chunk_y, group_columns), chunk_x, chunk_y))
+				return;
+		}
+	}
+}
+
+// Marks a chunk wanted in this frame, moving it to the back of the LRU list if it is loaded
+static void wantChunk(size_t index)
+{
+	stream_chunk_t& chunk = stream_chunks[index];
+
+	if (chunk.last_wanted == stream_frame)
+		return;
+
+	chunk.last_wanted = stream_frame;
+
+	if (chunk.state == CHUNK_LOADED && !chunk.changed)
+		lru_chunks.splice(lru_chunks.end(), lru_chunks, chunk.lru_position);
+}
+
+bool requestTiles(const tile_rect_t& rect)
+{
+	if (stream_file == nullptr)
+		return true;
+
+	bool loaded = true;
+
+	forEachChunk(rect, [&](size_t index, int chunk_x, int chunk_y)
+	{
+		stream_chunk_t& chunk = stream_chunks[index];
+
+		wantChunk(index);
+		chunk.last_requested = stream_frame;
+
+		if (chunk.state != CHUNK_LOADED)
+		{
+			loaded = false;
+
+			if (chunk.state == CHUNK_UNLOADED && !startLoad(index, chunk_x, chunk_y, false))
+				stream_waiting = true;
+		}
+
+		return true;
+	});
+
+	return loaded;
+}
+
+void prefetchTiles(const tile_rect_t& rect)
+{
+	if (stream_file == nullptr)
+		return;
+
+	forEachChunk(rect, [&](size_t index, int chunk_x, int chunk_y)
+	{
+		if (stream_chunks[index].state == CHUNK_UNLOADED && !startLoad(index, chunk_x, chunk_y, true))
+			return false;
+
+		wantChunk(index);
+
+		return true;
+	});
+}
+
+void prefetchLightTiles(const tile_rect_t& view)
+{
+	if (stream_file == nullptr)
+		return;
+
+	const int margin = LEVEL_STREAM_PREFETCH_MARGIN;
+	const tile_rect_t near_view = expandRect(view, margin);
+
+	for (int i = 0; i < getLightSlotCount(); ++i)
+	{
+		const tile_rect_t& bounds = light_bounds[i];
+
+		if (light_active[i] && !isRectEmpty(intersectRects(bounds, near_view)))
+			prefetchTiles(expandRect(bounds, margin));
+	}
+}
+
+bool isLevelStreamLoading()
+{
+	std::lock_guard<std::mutex> lock(io_mutex);
+
+	return (loads_in_flight > 0 || !finished_loads.empty());
+}
+
+bool isLevelStreamWaiting()
+{
+	return stream_waiting;
+}
+
+void waitForLevelStream()
+{
+	std::unique_lock<std::mutex> lock(io_mutex);
+
+	io_done_condition.wait(lock, [] { return loads_in_flight == 0; });
+}
+
+void keepTileLoaded(int x, int y)
+{
+	if (stream_file == nullptr)
+		return;
+
+	stream_chunk_t& chunk = stream_chunks[getTileIndex(x, y) >> (2 * LEVEL_CHUNK_SHIFT)];
+
+	if (chunk.state == CHUNK_LOADED && !chunk.changed)
+	{
+		chunk.changed = true;
+		lru_chunks.erase(chunk.lru_position);
+	}
+}
+
+size_t getLevelStreamBytes()
+{
+	return (chunk_buffers.size() - free_buffers.size()) * LEVEL_CHUNK_TILES;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "level.h"
+
+// Streams the chunks of a chunked binary level file in and out of a cache of
+// at most level_stream_budget bytes, instead of loading the whole level
+// A background thread reads the chunks asked for, and once a frame
+// updateLevelStream() puts the ones it has read into level_chunks
+// When the cache is full the chunk that went longest without being asked for
+// is dropped, except for chunks asked for in the current frame and chunks
+// with changed tiles, which stay until the level is closed
+const size_t DEFAULT_LEVEL_STREAM_BUDGET = 64 << 20;
+
+extern size_t level_stream_budget;
+
+// Tiles around the view and around the bounds of each light near it that are read ahead
+const int LEVEL_STREAM_PREFETCH_MARGIN = 64;
+
+// Opens a level file for streaming and sets the level's size, with every chunk
+// not yet loaded, call buildLevelChunks() and buildOccupancy() after it
+// Returns false and prints why if the file isn't a chunked level file
+bool openLevelStream(const char* filename);
+void closeLevelStream();
+
+bool isLevelStreamed();
+
+// Puts the chunks read since the last call into the level, and starts a new
+// frame, returns true if any were
+bool updateLevelStream();
+
+// Returns true if every chunk over rect is in memory, and keeps them there for
+// the rest of the frame, starting loads of any that aren't
+// Always true for a level that isn't streamed
+bool requestTiles(const tile_rect_t& rect);
+
+// Starts loads of the chunks over rect, and of those around the lights that
+// reach near the view, after any that were requested, without dropping chunks
+// used in this frame
+void prefetchTiles(const tile_rect_t& rect);
+void prefetchLightTiles(const tile_rect_t& view);
+
+// Returns true if any chunk is being read, or was asked for this frame with no room for it
+bool isLevelStreamLoading();
+bool isLevelStreamWaiting();
+
+// Waits until every chunk being read is done, they still need updateLevelStream()
+void waitForLevelStream();
+
+// Keeps the chunk over a changed tile in memory, as it no longer matches the file
+void keepTileLoaded(int x, int y);
+
+// Bytes of chunks held in memory
+size_t getLevelStreamBytes();
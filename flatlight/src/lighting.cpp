@@ -0,0 +1,1225 @@
+#include "lighting.h"
+
+#include "attenuation.h"
+#include "level.h"
+#include "levelstream.h"
+#include "lightmanager.h"
+#include "pack.h"
+#include "threadpool.h"
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+bool loadLights(const char* filename, std::vector<light_t>* lights)
+{
+	char buf[1024];
+
+	FILE* file = fopen(filename, "r");
+
+	if (file == nullptr)
+	{
+		fprintf(stderr, "Failed to open file for reading: %s\n", filename);
+		return false;
+	}
+
+	std::vector<light_t> loaded;
+
+	int line_number = 0;
+
+	while (fgets(buf, 1024, file))
+	{
+		line_number++;
+
+		// Skip leading whitespace, then blank and comment lines
+		const char* line = buf;
+
+		while (*line == ' ' || *line == '\t')
+			line++;
+
+		if (*line == '#' || *line == '\n' || *line == '\r' || *line == '\0')
+			continue;
+
+		int x, y;
+		float r, g, b;
+
+		// Falloff is optional
+		float linear = DEFAULT_LINEAR_ATTENUATION;
+		float quadratic = DEFAULT_QUADRATIC_ATTENUATION;
+
+		int fields = sscanf(line, "%d %d %f %f %f %f %f", &x, &y, &r, &g, &b, &linear, &quadratic);
+
+		if (fields != 5 && fields != 7)
+		{
+			fprintf(stderr, "Expected \"x y r g b [linear quadratic]\" on line %d of %s\n", line_number, filename);
+
+			fclose(file);
+			return false;
+		}
+
+		// getLightRadius() takes the brightest a channel can be as 1
+		loaded.push_back(light_t{ glm::clamp(glm::vec3(r, g, b), 0.0f, 1.0f), glm::vec2(x, y), linear, quadratic });
+	}
+
+	fclose(file);
+
+	if (loaded.empty())
+	{
+		fprintf(stderr, "No lights in %s\n", filename);
+		return false;
+	}
+
+	*lights = loaded;
+
+	printf("Lights: %d\n", (int)loaded.size());
+
+	return true;
+}
+
+float getLightRadius(const light_t& light)
+{
+	return attenuation_model_t::radius(light.linear, light.quadratic);
+}
+
+tile_rect_t getLightBounds(const light_t& light)
+{
+	// Keep the radius small enough to convert, the level is smaller anyway
+	const float radius = glm::min(getLightRadius(light), (float)(level_width + level_height));
+
+	// A tile further than the radius along either axis is further in a straight line too
+	tile_rect_t bounds{ (int)ceil(light.pos.x - radius), (int)ceil(light.pos.y - radius),
+		(int)floor(light.pos.x + radius) + 1, (int)floor(light.pos.y + radius) + 1 };
+
+	return intersectRects(bounds, getLevelRect());
+}
+
+size_t visibility_cache_budget = DEFAULT_VISIBILITY_CACHE_BUDGET;
+bool fixed_point_lighting = false;
+
+// A row of a region's visibility bits fits in one word, so regions of a light
+// can be worked out at the same time without sharing any
+static_assert(LIGHTING_REGION_SIZE == 16, "Visibility rows are stored as uint16_t");
+static_assert(LEVEL_CHUNK_SIZE % LIGHTING_REGION_SIZE == 0, "Each row of a region is a run of tiles in one chunk");
+
+// A light as it was last lit, with what it saw and how much of its colour
+// reaches each tile in its bounds
+struct light_cache_t
+{
+	bool active;
+	light_t light;
+	tile_rect_t bounds;
+
+	// One bit per tile, a word per row of each region the bounds overlap with
+	// bit i for the region's column i, in the same order as region_flags
+	// Empty once evicted, and worked out again for the regions that need it
+	std::vector<uint16_t> visibility;
+
+	// Visibility times attenuation, stored row by row over the bounds, and
+	// multiplied by the light's current colour whenever its regions are added up,
+	// so a light that only changes colour has nothing of its own to redo
+	std::vector<float> falloff;
+
+	// The same in fixed point for the integer path, with the colour in fixed
+	// point too, only the one for the path in use is kept
+	// Both are empty once evicted, which only lights adding to no region of the lightmap are
+	std::vector<uint16_t> falloff_fixed;
+	uint16_t colour_fixed[3];
+
+	// Regions the bounds overlap, and DIRTY_, REGION_LIT and VISIBILITY_CACHED flags for each of them
+	tile_rect_t regions;
+	std::vector<uint8_t> region_flags;
+	bool dirty;
+
+	// Update the visibility and falloff were last worked out or read in
+	uint32_t last_used;
+
+	// Index of the attenuation table for the light's falloff, -1 if it isn't on a whole tile
+	int attenuation_table;
+};
+
+// attenuation_model_t of a falloff at every whole squared distance from 0 up,
+// shared by all the lights with that falloff and grown to fit the largest of them
+struct attenuation_table_t
+{
+	float linear;
+	float quadratic;
+	std::vector<float> values;
+	std::vector<uint16_t> fixed_values;
+};
+
+// How each lighting path stores falloff and adds the lights up, the float path
+// and the fixed point one picked by fixed_point_lighting
+struct float_lighting_t
+{
+	typedef float value_t;
+
+	static std::vector<float>& getFalloff(light_cache_t& cache) { return cache.falloff; }
+	static const std::vector<float>& getFalloff(const light_cache_t& cache) { return cache.falloff; }
+	static const float* getTable(const attenuation_table_t& table) { return &table.values[0]; }
+	static float convert(float att) { return att; }
+
+	static void add(const light_cache_t& cache, const float* falloff, float* red, float* green, float* blue, int count)
+	{
+		addLightColour(falloff, cache.light.colour.r, cache.light.colour.g, cache.light.colour.b, red, green, blue, count);
+	}
+
+	static void pack(const float* red, const float* green, const float* blue, uint32_t* out, int count)
+	{
+		packColours(red, green, blue, out, count);
+	}
+};
+
+struct fixed_lighting_t
+{
+	typedef uint16_t value_t;
+
+	static std::vector<uint16_t>& getFalloff(light_cache_t& cache) { return cache.falloff_fixed; }
+	static const std::vector<uint16_t>& getFalloff(const light_cache_t& cache) { return cache.falloff_fixed; }
+	static const uint16_t* getTable(const attenuation_table_t& table) { return &table.fixed_values[0]; }
+	static uint16_t convert(float att) { return toFixedAttenuation(att); }
+
+	static void add(const light_cache_t& cache, const uint16_t* falloff, uint16_t* red, uint16_t* green, uint16_t* blue, int count)
+	{
+		addLightColourFixed(falloff, cache.colour_fixed[0], cache.colour_fixed[1], cache.colour_fixed[2], red, green, blue, count);
+	}
+
+	static void pack(const uint16_t* red, const uint16_t* green, const uint16_t* blue, uint32_t* out, int count)
+	{
+		packColoursFixed(red, green, blue, out, count);
+	}
+};
+
+// A light and a region of the level to relight it in, and whether it lit any tile there
+struct lighting_job_t
+{
+	int light;
+	int region;
+	bool lit;
+};
+
+// Everything kept between frames so only lights and regions that changed get
+// relit, the caches are indexed by light id
+static bool cache_valid = false;
+static visibility_mode_t cached_mode;
+static bool cached_fixed_point;
+static int cached_level_width;
+static int cached_level_height;
+static std::vector<light_cache_t> cached_lights;
+
+// Ids of lights with any dirty region, and of those still waiting for their
+// tiles to be loaded in this update
+static std::vector<int> dirty_lights;
+static std::vector<int> waiting_lights;
+
+// Square regions of LIGHTING_REGION_SIZE tiles, regions whose final colours need adding up again
+static int region_columns;
+static int region_rows;
+static std::vector<uint8_t> region_dirty;
+
+// Lights that add to some tile of each region, in id order, so the lights
+// that are out of reach or shadowed in a region are never summed there
+static std::vector<std::vector<int>> region_lights;
+
+// The view from setLightingView(), and the tiles and regions the lightmap
+// covers around it, with their colours row by row
+static tile_rect_t lighting_view{ 0, 0, INT_MAX, INT_MAX };
+static tile_rect_t lightmap_rect;
+static tile_rect_t lightmap_regions;
+static std::vector<uint32_t> lightmap;
+
+// What the lightmap is moved into when the view moves, then swapped with it
+static std::vector<uint32_t> moved_lightmap;
+
+// Reused lists of jobs for parallelFor()
+static std::vector<lighting_job_t> jobs;
+static std::vector<int> region_jobs;
+
+// Attenuation tables, dropped when there are more than MAX_ATTENUATION_TABLES
+// at the start of an update, before the dirty lights pick theirs
+static std::vector<attenuation_table_t> attenuation_tables;
+
+const size_t MAX_ATTENUATION_TABLES = 64;
+
+// Most squared distances a table covers, 6 MB with its fixed point copy,
+// lights that would need more work out their attenuation at every tile
+const int64_t MAX_ATTENUATION_TABLE_SIZE = 1 << 20;
+
+// Count of updateLighting() calls, and the bytes held by every light's visibility bits and falloff
+static uint32_t lighting_update = 0;
+static size_t visibility_bytes = 0;
+static size_t falloff_bytes = 0;
+
+enum
+{
+	DIRTY_FALLOFF = 1,
+	DIRTY_VISIBILITY = 2,
+
+	// The light is in the region's light list, kept while the dirty flags are cleared
+	REGION_LIT = 4,
+
+	// The region's visibility bits are up to date, cleared when they are evicted
+	VISIBILITY_CACHED = 8
+};
+
+// Returns the index of the attenuation table for a falloff, adding it or
+// filling in more of it so it reaches max_distance_squared
+template <typename model_t>
+static int getAttenuationTable(float linear, float quadratic, int64_t max_distance_squared)
+{
+	size_t table = 0;
+
+	while (table < attenuation_tables.size() &&
+		(attenuation_tables[table].linear != linear || attenuation_tables[table].quadratic != quadratic))
+	{
+		table++;
+	}
+
+	if (table == attenuation_tables.size())
+		attenuation_tables.push_back(attenuation_table_t{ linear, quadratic, std::vector<float>(), std::vector<uint16_t>() });
+
+	std::vector<float>& values = attenuation_tables[table].values;
+
+	std::vector<uint16_t>& fixed_values = attenuation_tables[table].fixed_values;
+
+	for (int64_t d = (int64_t)values.size(); d <= max_distance_squared; ++d)
+	{
+		values.push_back(model_t::attenuate(linear, quadratic, (float)d));
+		fixed_values.push_back(toFixedAttenuation(values.back()));
+	}
+
+	return (int)table;
+}
+
+// Picks the attenuation table for a light in its bounds
+static void findAttenuationTable(light_cache_t& cache)
+{
+	const light_t& light = cache.light;
+
+	if (isRectEmpty(cache.bounds) || light.pos.x != floor(light.pos.x) || light.pos.y != floor(light.pos.y))
+	{
+		cache.attenuation_table = -1;
+		return;
+	}
+
+	const int lightx = (int)light.pos.x;
+	const int lighty = (int)light.pos.y;
+
+	// The furthest tile of the bounds along each axis
+	const int64_t dx = glm::max(abs(cache.bounds.x_begin - lightx), abs(cache.bounds.x_end - 1 - lightx));
+	const int64_t dy = glm::max(abs(cache.bounds.y_begin - lighty), abs(cache.bounds.y_end - 1 - lighty));
+
+	// The table stops at the radius, tiles in the corners of the bounds past it
+	// are worked out one at a time
+	const double radius = getLightRadius(light);
+
+	int64_t max_distance_squared = dx * dx + dy * dy;
+
+	if (radius * radius < (double)max_distance_squared)
+		max_distance_squared = (int64_t)ceil(radius * radius);
+
+	if (max_distance_squared >= MAX_ATTENUATION_TABLE_SIZE)
+	{
+		cache.attenuation_table = -1;
+		return;
+	}
+
+	cache.attenuation_table = getAttenuationTable<attenuation_model_t>(light.linear, light.quadratic, max_distance_squared);
+}
+
+static tile_rect_t getRegionRect(int region)
+{
+	const int x_begin = (region % region_columns) * LIGHTING_REGION_SIZE;
+	const int y_begin = (region / region_columns) * LIGHTING_REGION_SIZE;
+
+	return intersectRects(tile_rect_t{ x_begin, y_begin, x_begin + LIGHTING_REGION_SIZE, y_begin + LIGHTING_REGION_SIZE },
+		getLevelRect());
+}
+
+// Regions overlapping a rectangle of tiles, as a rectangle of region columns and rows
+static tile_rect_t getRegionsOverlapping(const tile_rect_t& rect)
+{
+	if (isRectEmpty(rect))
+		return tile_rect_t{ 0, 0, 0, 0 };
+
+	return tile_rect_t{ rect.x_begin / LIGHTING_REGION_SIZE, rect.y_begin / LIGHTING_REGION_SIZE,
+		(rect.x_end - 1) / LIGHTING_REGION_SIZE + 1, (rect.y_end - 1) / LIGHTING_REGION_SIZE + 1 };
+}
+
+static bool isRegionInLightmap(int region)
+{
+	return isInRect(lightmap_regions, region % region_columns, region / region_columns);
+}
+
+// Tiles the lightmap covers for the current view, whole regions clipped to the level
+static tile_rect_t getViewLightmapRect()
+{
+	const tile_rect_t level_rect = getLevelRect();
+	const tile_rect_t view = intersectRects(lighting_view, level_rect);
+
+	if (isRectEmpty(view))
+		return tile_rect_t{ 0, 0, 0, 0 };
+
+	const tile_rect_t regions = getRegionsOverlapping(intersectRects(expandRect(view, LIGHTING_VIEW_MARGIN), level_rect));
+
+	return intersectRects(tile_rect_t{ regions.x_begin * LIGHTING_REGION_SIZE, regions.y_begin * LIGHTING_REGION_SIZE,
+		regions.x_end * LIGHTING_REGION_SIZE, regions.y_end * LIGHTING_REGION_SIZE }, level_rect);
+}
+
+// Moves the lightmap to cover rect, keeping the colours of the tiles it still
+// covers, and marks the regions it newly covers to be added up
+static void moveLightmap(const tile_rect_t& rect)
+{
+	const tile_rect_t kept = intersectRects(rect, lightmap_rect);
+	const tile_rect_t old_regions = lightmap_regions;
+
+	const int width = rect.x_end - rect.x_begin;
+	const int old_width = lightmap_rect.x_end - lightmap_rect.x_begin;
+
+	moved_lightmap.assign(isRectEmpty(rect) ? 0 : width * (rect.y_end - rect.y_begin), 0);
+
+	if (!isRectEmpty(kept))
+	{
+		for (int y = kept.y_begin; y < kept.y_end; ++y)
+		{
+			const uint32_t* row = &lightmap[(y - lightmap_rect.y_begin) * old_width + kept.x_begin - lightmap_rect.x_begin];
+
+			std::copy(row, row + kept.x_end - kept.x_begin,
+				&moved_lightmap[(y - rect.y_begin) * width + kept.x_begin - rect.x_begin]);
+		}
+	}
+
+	lightmap.swap(moved_lightmap);
+
+	lightmap_rect = rect;
+	lightmap_regions = getRegionsOverlapping(rect);
+
+	for (int ry = lightmap_regions.y_begin; ry < lightmap_regions.y_end; ++ry)
+	{
+		for (int rx = lightmap_regions.x_begin; rx < lightmap_regions.x_end; ++rx)
+		{
+			if (!isInRect(old_regions, rx, ry))
+				region_dirty[ry * region_columns + rx] = 1;
+		}
+	}
+}
+
+// Converts between an index into a light's region flags and a region of the level
+static int getCacheRegion(const light_cache_t& cache, int index)
+{
+	const int span = cache.regions.x_end - cache.regions.x_begin;
+
+	return (cache.regions.y_begin + index / span) * region_columns + cache.regions.x_begin + index % span;
+}
+
+static int getCacheRegionIndex(const light_cache_t& cache, int region)
+{
+	const int span = cache.regions.x_end - cache.regions.x_begin;
+
+	return (region / region_columns - cache.regions.y_begin) * span + region % region_columns - cache.regions.x_begin;
+}
+
+// Takes a light out of the light lists of every region it was lit in
+static void unlistLight(int light)
+{
+	const light_cache_t& cache = cached_lights[light];
+
+	for (size_t j = 0; j < cache.region_flags.size(); ++j)
+	{
+		if (cache.region_flags[j] & REGION_LIT)
+			eraseLightId(region_lights[getCacheRegion(cache, (int)j)], light);
+	}
+}
+
+// Marks the regions of a light's bounds that overlap a rectangle of tiles
+static void markLightDirty(int light, int flags, const tile_rect_t& rect)
+{
+	light_cache_t& cache = cached_lights[light];
+
+	const tile_rect_t regions = intersectRects(getRegionsOverlapping(intersectRects(rect, cache.bounds)), cache.regions);
+
+	if (isRectEmpty(regions))
+		return;
+
+	const int span = cache.regions.x_end - cache.regions.x_begin;
+
+	for (int ry = regions.y_begin; ry < regions.y_end; ++ry)
+	{
+		for (int rx = regions.x_begin; rx < regions.x_end; ++rx)
+			cache.region_flags[(ry - cache.regions.y_begin) * span + rx - cache.regions.x_begin] |= flags;
+	}
+
+	if (!cache.dirty)
+	{
+		cache.dirty = true;
+		dirty_lights.push_back(light);
+	}
+}
+
+// Returns true if a light has a dirty region in the lightmap
+static bool isLightDirtyInLightmap(const light_cache_t& cache)
+{
+	const tile_rect_t regions = intersectRects(cache.regions, lightmap_regions);
+	const int span = cache.regions.x_end - cache.regions.x_begin;
+
+	for (int ry = regions.y_begin; ry < regions.y_end; ++ry)
+	{
+		for (int rx = regions.x_begin; rx < regions.x_end; ++rx)
+		{
+			if (cache.region_flags[(ry - cache.regions.y_begin) * span + rx - cache.regions.x_begin] & (DIRTY_FALLOFF | DIRTY_VISIBILITY))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+// Marks the final colours of every region overlapping a rectangle of tiles
+static void markRegionsDirty(const tile_rect_t& rect)
+{
+	const tile_rect_t regions = getRegionsOverlapping(rect);
+
+	for (int ry = regions.y_begin; ry < regions.y_end; ++ry)
+	{
+		for (int rx = regions.x_begin; rx < regions.x_end; ++rx)
+			region_dirty[ry * region_columns + rx] = 1;
+	}
+}
+
+// Gives a light zeroed visibility bits for every region it overlaps
+static void allocateVisibility(light_cache_t& cache)
+{
+	visibility_bytes -= cache.visibility.size() * sizeof(uint16_t);
+	cache.visibility.assign(cache.region_flags.size() * LIGHTING_REGION_SIZE, 0);
+	visibility_bytes += cache.visibility.size() * sizeof(uint16_t);
+}
+
+// Frees a light's visibility bits, they are worked out again the next time its falloff is
+static void evictVisibility(light_cache_t& cache)
+{
+	visibility_bytes -= cache.visibility.size() * sizeof(uint16_t);
+	std::vector<uint16_t>().swap(cache.visibility);
+
+	for (size_t j = 0; j < cache.region_flags.size(); ++j)
+		cache.region_flags[j] &= ~VISIBILITY_CACHED;
+}
+
+static size_t getFalloffBytes(const light_cache_t& cache)
+{
+	return cache.falloff.size() * sizeof(float) + cache.falloff_fixed.size() * sizeof(uint16_t);
+}
+
+// Gives a light zeroed falloff over its bounds for the lighting path in use
+static void allocateFalloff(light_cache_t& cache)
+{
+	const int size = (isRectEmpty(cache.bounds) ? 0 :
+		(cache.bounds.x_end - cache.bounds.x_begin) * (cache.bounds.y_end - cache.bounds.y_begin));
+
+	falloff_bytes -= getFalloffBytes(cache);
+
+	if (fixed_point_lighting)
+		cache.falloff_fixed.assign(size, 0);
+	else
+		cache.falloff.assign(size, 0.0f);
+
+	falloff_bytes += getFalloffBytes(cache);
+}
+
+static void freeFalloff(light_cache_t& cache)
+{
+	falloff_bytes -= getFalloffBytes(cache);
+	std::vector<float>().swap(cache.falloff);
+	std::vector<uint16_t>().swap(cache.falloff_fixed);
+}
+
+// Returns true if a light adds to any region of the lightmap, so its falloff
+// is needed whenever they are added up again
+static bool isLightLitInLightmap(const light_cache_t& cache)
+{
+	const tile_rect_t regions = intersectRects(cache.regions, lightmap_regions);
+	const int span = cache.regions.x_end - cache.regions.x_begin;
+
+	for (int ry = regions.y_begin; ry < regions.y_end; ++ry)
+	{
+		for (int rx = regions.x_begin; rx < regions.x_end; ++rx)
+		{
+			if (cache.region_flags[(ry - cache.regions.y_begin) * span + rx - cache.regions.x_begin] & REGION_LIT)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+// Frees the falloff of a light that adds to no region of the lightmap, the
+// regions beyond it that it lit lose it until they are relit
+static void evictFalloff(int light)
+{
+	light_cache_t& cache = cached_lights[light];
+
+	for (size_t j = 0; j < cache.region_flags.size(); ++j)
+	{
+		if (cache.region_flags[j] & REGION_LIT)
+		{
+			const int region = getCacheRegion(cache, (int)j);
+
+			eraseLightId(region_lights[region], light);
+			cache.region_flags[j] &= ~REGION_LIT;
+
+			markLightDirty(light, DIRTY_FALLOFF, getRegionRect(region));
+		}
+	}
+
+	freeFalloff(cache);
+}
+
+static void setFixedColour(light_cache_t& cache)
+{
+	cache.colour_fixed[0] = toFixedChannel(cache.light.colour.r);
+	cache.colour_fixed[1] = toFixedChannel(cache.light.colour.g);
+	cache.colour_fixed[2] = toFixedChannel(cache.light.colour.b);
+}
+
+// Fits a light's cache to the light, and marks everything it covers
+static void resetLightCache(int light, const light_t& current)
+{
+	light_cache_t& cache = cached_lights[light];
+
+	// Its old tiles lose its colour
+	if (cache.active)
+	{
+		markRegionsDirty(cache.bounds);
+		unlistLight(light);
+	}
+
+	cache.active = true;
+	cache.light = current;
+	cache.bounds = light_bounds[light];
+	cache.regions = getRegionsOverlapping(cache.bounds);
+
+	// Its falloff is allocated when it's first lit
+	freeFalloff(cache);
+	setFixedColour(cache);
+	cache.region_flags.assign((cache.regions.x_end - cache.regions.x_begin) * (cache.regions.y_end - cache.regions.y_begin), 0);
+
+	allocateVisibility(cache);
+
+	markLightDirty(light, DIRTY_VISIBILITY | DIRTY_FALLOFF, cache.bounds);
+}
+
+// Drops the cache of a light that was removed
+static void clearLightCache(int light)
+{
+	light_cache_t& cache = cached_lights[light];
+
+	markRegionsDirty(cache.bounds);
+	unlistLight(light);
+
+	cache.active = false;
+	cache.bounds = tile_rect_t{ 0, 0, 0, 0 };
+	cache.regions = tile_rect_t{ 0, 0, 0, 0 };
+
+	evictVisibility(cache);
+	freeFalloff(cache);
+	std::vector<uint8_t>().swap(cache.region_flags);
+}
+
+// Evicts the visibility bits of the lights that went longest without using
+// them until the bits and falloff fit the budget, then their falloff too if
+// that isn't enough, keeping whatever was used in this update
+static void enforceVisibilityBudget()
+{
+	if (visibility_bytes + falloff_bytes <= visibility_cache_budget)
+		return;
+
+	std::vector<int> resident;
+
+	for (size_t i = 0; i < cached_lights.size(); ++i)
+	{
+		if ((!cached_lights[i].visibility.empty() || getFalloffBytes(cached_lights[i]) > 0) &&
+			cached_lights[i].last_used != lighting_update)
+		{
+			resident.push_back((int)i);
+		}
+	}
+
+	std::sort(resident.begin(), resident.end(), [](int a, int b)
+	{
+		if (cached_lights[a].last_used != cached_lights[b].last_used)
+			return cached_lights[a].last_used < cached_lights[b].last_used;
+
+		return a < b;
+	});
+
+	for (size_t i = 0; i < resident.size() && visibility_bytes + falloff_bytes > visibility_cache_budget; ++i)
+		evictVisibility(cached_lights[resident[i]]);
+
+	// Falloff costs a pass over the light's tiles to get back, and its
+	// visibility too by now, so it goes last, and the lights adding to the
+	// lightmap keep theirs as they would only be relit straight away
+	for (size_t i = 0; i < resident.size() && visibility_bytes + falloff_bytes > visibility_cache_budget; ++i)
+	{
+		const light_cache_t& cache = cached_lights[resident[i]];
+
+		if (getFalloffBytes(cache) > 0 && !isLightLitInLightmap(cache))
+			evictFalloff(resident[i]);
+	}
+}
+
+size_t getVisibilityCacheBytes()
+{
+	return visibility_bytes;
+}
+
+size_t getFalloffCacheBytes()
+{
+	return falloff_bytes;
+}
+
+void invalidateLighting()
+{
+	cache_valid = false;
+}
+
+void invalidateLightingTile(int x, int y)
+{
+	if (!cache_valid)
+		return;
+
+	// The tile's own colour changes even with no lights
+	region_dirty[(y / LIGHTING_REGION_SIZE) * region_columns + x / LIGHTING_REGION_SIZE] = 1;
+
+	// Rays to tiles in a light's bounds never leave them by more than a tile,
+	// so only lights reaching a cell next to the tile can be affected
+	const tile_rect_t around = intersectRects(tile_rect_t{ x - 1, y - 1, x + 2, y + 2 }, getLevelRect());
+
+	for (int cy = around.y_begin / LIGHT_CELL_SIZE; cy <= (around.y_end - 1) / LIGHT_CELL_SIZE; ++cy)
+	{
+		for (int cx = around.x_begin / LIGHT_CELL_SIZE; cx <= (around.x_end - 1) / LIGHT_CELL_SIZE; ++cx)
+		{
+			const std::vector<int>& ids = getLightsReachingCell(getLightCell(cx * LIGHT_CELL_SIZE, cy * LIGHT_CELL_SIZE));
+
+			for (size_t i = 0; i < ids.size(); ++i)
+			{
+				// Lights added since the last update are lit in full anyway
+				if (ids[i] >= (int)cached_lights.size() || !cached_lights[ids[i]].active)
+					continue;
+
+				const light_cache_t& cache = cached_lights[ids[i]];
+				const tile_rect_t& bounds = cache.bounds;
+
+				if (!isInRect(tile_rect_t{ bounds.x_begin - 1, bounds.y_begin - 1, bounds.x_end + 1, bounds.y_end + 1 }, x, y))
+					continue;
+
+				const int lightx = (int)cache.light.pos.x;
+				const int lighty = (int)cache.light.pos.y;
+
+				// Rays only pass through the tile on their way to tiles beyond it from
+				// the light, or one tile short of it as raycast() can step one past its end
+				const tile_rect_t shadow{ (x > lightx ? x - 1 : 0), (y > lighty ? y - 1 : 0),
+					(x < lightx ? x + 2 : level_width), (y < lighty ? y + 2 : level_height) };
+
+				markLightDirty(ids[i], DIRTY_VISIBILITY | DIRTY_FALLOFF, shadow);
+			}
+		}
+	}
+}
+
+// Packs the tiles of a region in a light's bounds from visible, which covers window as in
+// computeVisibilityWindow(), into the light's visibility bits
+static void storeVisibility(light_cache_t& cache, int region, const uint8_t* visible, const tile_rect_t& window)
+{
+	const tile_rect_t region_rect = getRegionRect(region);
+	const tile_rect_t rect = intersectRects(cache.bounds, region_rect);
+
+	const int index = getCacheRegionIndex(cache, region);
+	const int window_width = window.x_end - window.x_begin;
+
+	uint16_t* rows = &cache.visibility[index * LIGHTING_REGION_SIZE];
+
+	for (int y = rect.y_begin; y < rect.y_end; ++y)
+	{
+		const uint8_t* row = &visible[(y - window.y_begin) * window_width - window.x_begin];
+		uint16_t bits = 0;
+
+		for (int x = rect.x_begin; x < rect.x_end; ++x)
+		{
+			if (row[x])
+				bits |= 1 << (x - region_rect.x_begin);
+		}
+
+		rows[y - region_rect.y_begin] = bits;
+	}
+
+	cache.region_flags[index] |= VISIBILITY_CACHED;
+}
+
+// Works out the falloff of a light at each tile of a region in its bounds,
+// returns true if it reaches any of them
+// Lights on whole tiles look their attenuation up by squared distance, the
+// same value the model gives, others work it out for every tile
+template <typename model_t, typename lighting_t>
+static bool computeFalloff(light_cache_t& cache, int region)
+{
+	bool lit = false;
+
+	const light_t& light = cache.light;
+	const int bounds_width = cache.bounds.x_end - cache.bounds.x_begin;
+
+	const tile_rect_t region_rect = getRegionRect(region);
+	const tile_rect_t rect = intersectRects(cache.bounds, region_rect);
+
+	const uint16_t* rows = &cache.visibility[getCacheRegionIndex(cache, region) * LIGHTING_REGION_SIZE];
+
+	typedef typename lighting_t::value_t value_t;
+
+	const value_t* table = (cache.attenuation_table >= 0 ? lighting_t::getTable(attenuation_tables[cache.attenuation_table]) : nullptr);
+	const int table_size = (cache.attenuation_table >= 0 ? (int)attenuation_tables[cache.attenuation_table].values.size() : 0);
+
+	const int lightx = (int)light.pos.x;
+	const int lighty = (int)light.pos.y;
+
+	for (int y = rect.y_begin; y < rect.y_end; ++y)
+	{
+		const int bits = rows[y - region_rect.y_begin];
+
+		// The region's row is contiguous in its chunk
+		const char* tiles = getTilePointer(rect.x_begin, y) - rect.x_begin;
+		value_t* falloff = &lighting_t::getFalloff(cache)[(y - cache.bounds.y_begin) * bounds_width - cache.bounds.x_begin];
+
+		if (table != nullptr)
+		{
+			const int64_t dy_squared = (int64_t)(y - lighty) * (y - lighty);
+
+			for (int x = rect.x_begin; x < rect.x_end; ++x)
+			{
+				const bool seen = (tiles[x] != '#' && ((bits >> (x - region_rect.x_begin)) & 1));
+				const int64_t distance_squared = (int64_t)(x - lightx) * (x - lightx) + dy_squared;
+
+				if (!seen)
+					falloff[x] = 0;
+				else if (distance_squared < table_size)
+					falloff[x] = table[distance_squared];
+				else
+					falloff[x] = lighting_t::convert(model_t::attenuate(light.linear, light.quadratic, (float)distance_squared));
+
+				lit |= seen;
+			}
+		}
+		else
+		{
+			for (int x = rect.x_begin; x < rect.x_end; ++x)
+			{
+				const bool seen = (tiles[x] != '#' && ((bits >> (x - region_rect.x_begin)) & 1));
+
+				float diffx = x - light.pos.x;
+				float diffy = y - light.pos.y;
+
+				falloff[x] = (seen ? lighting_t::convert(model_t::attenuate(light.linear, light.quadratic, diffx * diffx + diffy * diffy)) : 0);
+				lit |= seen;
+			}
+		}
+	}
+
+	return lit;
+}
+
+// Adds up the lights in a region's light list, each light's falloff times its
+// colour, into separate red, green and blue planes, then packs them a row at a time
+template <typename lighting_t>
+static void composeRegion(int region)
+{
+	typedef typename lighting_t::value_t value_t;
+
+	const tile_rect_t rect = getRegionRect(region);
+	const int lightmap_width = lightmap_rect.x_end - lightmap_rect.x_begin;
+
+	const int plane_size = LIGHTING_REGION_SIZE * LIGHTING_REGION_SIZE;
+
+	value_t red[plane_size] = {};
+	value_t green[plane_size] = {};
+	value_t blue[plane_size] = {};
+
+	// Lights are added in id order, so each tile's sum is the same however it
+	// was relit, and leaving out lights that add nothing doesn't change it
+	const std::vector<int>& ids = region_lights[region];
+
+	for (size_t i = 0; i < ids.size(); ++i)
+	{
+		const light_cache_t& cache = cached_lights[ids[i]];
+		const tile_rect_t overlap = intersectRects(cache.bounds, rect);
+
+		const std::vector<value_t>& falloff = lighting_t::getFalloff(cache);
+		const int bounds_width = cache.bounds.x_end - cache.bounds.x_begin;
+
+		for (int y = overlap.y_begin; y < overlap.y_end; ++y)
+		{
+			const int index = (y - cache.bounds.y_begin) * bounds_width + overlap.x_begin - cache.bounds.x_begin;
+			const int row = (y - rect.y_begin) * LIGHTING_REGION_SIZE + overlap.x_begin - rect.x_begin;
+
+			lighting_t::add(cache, &falloff[index], &red[row], &green[row], &blue[row], overlap.x_end - overlap.x_begin);
+		}
+	}
+
+	for (int y = rect.y_begin; y < rect.y_end; ++y)
+	{
+		const int row = (y - rect.y_begin) * LIGHTING_REGION_SIZE;
+
+		uint32_t* colours = &lightmap[(y - lightmap_rect.y_begin) * lightmap_width + rect.x_begin - lightmap_rect.x_begin];
+
+		// Clamp and convert to colour
+		lighting_t::pack(&red[row], &green[row], &blue[row], colours, rect.x_end - rect.x_begin);
+
+		// Walls are grey whatever light reaches them
+		const char* tiles = getTilePointer(rect.x_begin, y) - rect.x_begin;
+
+		for (int x = rect.x_begin; x < rect.x_end; ++x)
+		{
+			if (tiles[x] == '#')
+				setTile(x, y, 0x808080);
+		}
+	}
+}
+
+bool updateLighting(visibility_mode_t mode)
+{
+	// Start again from nothing if anything the whole cache depends on changed
+	if (!cache_valid || mode != cached_mode || level_width != cached_level_width || level_height != cached_level_height ||
+		fixed_point_lighting != cached_fixed_point)
+	{
+		region_columns = (level_width + LIGHTING_REGION_SIZE - 1) / LIGHTING_REGION_SIZE;
+		region_rows = (level_height + LIGHTING_REGION_SIZE - 1) / LIGHTING_REGION_SIZE;
+
+		region_dirty.assign(region_columns * region_rows, 1);
+		region_lights.assign(region_columns * region_rows, std::vector<int>());
+
+		cached_lights.clear();
+		dirty_lights.clear();
+		attenuation_tables.clear();
+
+		visibility_bytes = 0;
+		falloff_bytes = 0;
+
+		cached_mode = mode;
+		cached_fixed_point = fixed_point_lighting;
+		cached_level_width = level_width;
+		cached_level_height = level_height;
+
+		// Every region is dirty, so the lightmap keeps nothing
+		lightmap_rect = tile_rect_t{ 0, 0, 0, 0 };
+		lightmap_regions = tile_rect_t{ 0, 0, 0, 0 };
+
+		cache_valid = true;
+	}
+
+	// Follow the view
+	const tile_rect_t view_lightmap_rect = getViewLightmapRect();
+	const bool lightmap_moved = !areRectsEqual(view_lightmap_rect, lightmap_rect);
+
+	if (lightmap_moved)
+		moveLightmap(view_lightmap_rect);
+
+	lighting_update++;
+
+	// Slots added since the last update start out inactive
+	light_cache_t inactive;
+	inactive.active = false;
+	inactive.dirty = false;
+	inactive.last_used = 0;
+	inactive.attenuation_table = -1;
+
+	cached_lights.resize(getLightSlotCount(), inactive);
+
+	for (int i = 0; i < getLightSlotCount(); ++i)
+	{
+		light_cache_t& cache = cached_lights[i];
+
+		if (!light_active[i])
+		{
+			if (cache.active)
+				clearLightCache(i);
+
+			continue;
+		}
+
+		const light_t current = getLight(i);
+
+		if (!cache.active || current.pos != cache.light.pos || current.linear != cache.light.linear ||
+			current.quadratic != cache.light.quadratic)
+		{
+			// A new light, or one that moved or changed its falloff, sees different tiles
+			resetLightCache(i, current);
+		}
+		else if (current.colour != cache.light.colour)
+		{
+			// One that only changed colour keeps its falloff, and the regions it reaches are just added up again
+			cache.light.colour = current.colour;
+			setFixedColour(cache);
+
+			for (size_t j = 0; j < cache.region_flags.size(); ++j)
+			{
+				if (cache.region_flags[j] & REGION_LIT)
+					region_dirty[getCacheRegion(cache, (int)j)] = 1;
+			}
+		}
+	}
+
+	// Lights wait, still dirty, until they have a dirty region in the lightmap,
+	// and those of a streamed level until every tile they can trace through is
+	// loaded too, which is a tile past their bounds
+	waiting_lights.clear();
+
+	size_t ready_lights = 0;
+
+	for (size_t i = 0; i < dirty_lights.size(); ++i)
+	{
+		const light_cache_t& cache = cached_lights[dirty_lights[i]];
+
+		if (isRectEmpty(cache.bounds) || (isLightDirtyInLightmap(cache) && requestTiles(expandRect(cache.bounds, 1))))
+		{
+			dirty_lights[ready_lights++] = dirty_lights[i];
+		}
+		else
+		{
+			waiting_lights.push_back(dirty_lights[i]);
+		}
+	}
+
+	dirty_lights.resize(ready_lights);
+
+	// Work out visibility for each dirty light and region, modes that can't
+	// do part of a light at a time redo the whole light once
+	const bool per_tile = isVisibilityPerTile(mode);
+
+	jobs.clear();
+
+	// Only dirty lights use their tables, so lights whose falloff keeps changing can't pile them up
+	if (attenuation_tables.size() > MAX_ATTENUATION_TABLES)
+		attenuation_tables.clear();
+
+	for (size_t i = 0; i < dirty_lights.size(); ++i)
+	{
+		light_cache_t& cache = cached_lights[dirty_lights[i]];
+
+		// Regions whose falloff is redone need their visibility bits back if they were evicted,
+		// and the light needs its falloff if it has none yet
+		if (cache.visibility.empty())
+			allocateVisibility(cache);
+
+		if (getFalloffBytes(cache) == 0)
+			allocateFalloff(cache);
+
+		cache.last_used = lighting_update;
+
+		findAttenuationTable(cache);
+
+		for (size_t j = 0; j < cache.region_flags.size(); ++j)
+		{
+			if ((cache.region_flags[j] & DIRTY_FALLOFF) && !(cache.region_flags[j] & VISIBILITY_CACHED))
+				cache.region_flags[j] |= DIRTY_VISIBILITY;
+		}
+
+		for (size_t j = 0; j < cache.region_flags.size(); ++j)
+		{
+			const int region = getCacheRegion(cache, (int)j);
+
+			if ((cache.region_flags[j] & DIRTY_VISIBILITY) && isRegionInLightmap(region))
+			{
+				jobs.push_back(lighting_job_t{ dirty_lights[i], region, false });
+
+				if (!per_tile)
+				{
+					// Which stores every region's bits, those beyond the lightmap included
+					for (size_t k = 0; k < cache.region_flags.size(); ++k)
+						cache.region_flags[k] &= ~DIRTY_VISIBILITY;
+
+					break;
+				}
+			}
+		}
+	}
+
+	parallelFor((int)jobs.size(), [&](int job)
+	{
+		light_cache_t& cache = cached_lights[jobs[job].light];
+
+		const int lightx = (int)cache.light.pos.x;
+		const int lighty = (int)cache.light.pos.y;
+
+		if (per_tile)
+		{
+			// Only the region's own tiles are worked out, into a window just over them
+			const tile_rect_t rect = intersectRects(cache.bounds, getRegionRect(jobs[job].region));
+
+			uint8_t visible[LIGHTING_REGION_SIZE * LIGHTING_REGION_SIZE];
+
+			computeVisibilityRect(mode, lightx, lighty, visible, rect, rect);
+			storeVisibility(cache, jobs[job].region, visible, rect);
+		}
+		else
+		{
+			std::vector<uint8_t> visible((cache.bounds.x_end - cache.bounds.x_begin) * (cache.bounds.y_end - cache.bounds.y_begin));
+
+			computeVisibilityWindow(mode, lightx, lighty, &visible[0], cache.bounds);
+
+			for (size_t j = 0; j < cache.region_flags.size(); ++j)
+				storeVisibility(cache, getCacheRegion(cache, (int)j), &visible[0], cache.bounds);
+		}
+	});
+
+	// Then their falloff
+	jobs.clear();
+
+	for (size_t i = 0; i < dirty_lights.size(); ++i)
+	{
+		light_cache_t& cache = cached_lights[dirty_lights[i]];
+
+		cache.dirty = false;
+
+		for (size_t j = 0; j < cache.region_flags.size(); ++j)
+		{
+			const int region = getCacheRegion(cache, (int)j);
+
+			// Regions beyond the lightmap keep their flags, and the light stays dirty
+			if (!isRegionInLightmap(region))
+			{
+				cache.dirty |= ((cache.region_flags[j] & (DIRTY_FALLOFF | DIRTY_VISIBILITY)) != 0);
+				continue;
+			}
+
+			if (cache.region_flags[j] & DIRTY_FALLOFF)
+			{
+				jobs.push_back(lighting_job_t{ dirty_lights[i], region, false });
+
+				region_dirty[region] = 1;
+			}
+
+			cache.region_flags[j] &= REGION_LIT | VISIBILITY_CACHED;
+		}
+
+		if (cache.dirty)
+			waiting_lights.push_back(dirty_lights[i]);
+	}
+
+	dirty_lights.swap(waiting_lights);
+
+	parallelFor((int)jobs.size(), [&](int job)
+	{
+		light_cache_t& cache = cached_lights[jobs[job].light];
+
+		if (fixed_point_lighting)
+			jobs[job].lit = computeFalloff<attenuation_model_t, fixed_lighting_t>(cache, jobs[job].region);
+		else
+			jobs[job].lit = computeFalloff<attenuation_model_t, float_lighting_t>(cache, jobs[job].region);
+	});
+
+	// Keep the region light lists up to date with where each light now adds
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		light_cache_t& cache = cached_lights[jobs[i].light];
+		uint8_t& flags = cache.region_flags[getCacheRegionIndex(cache, jobs[i].region)];
+
+		if (jobs[i].lit && !(flags & REGION_LIT))
+		{
+			insertLightId(region_lights[jobs[i].region], jobs[i].light);
+			flags |= REGION_LIT;
+		}
+		else if (!jobs[i].lit && (flags & REGION_LIT))
+		{
+			eraseLightId(region_lights[jobs[i].region], jobs[i].light);
+			flags &= ~REGION_LIT;
+		}
+	}
+
+	// And add the lights up again in regions of the lightmap where any of them changed
+	region_jobs.clear();
+
+	// A level chunk at a time, so the jobs on each thread read nearby tiles
+	const int chunk_regions = LEVEL_CHUNK_SIZE / LIGHTING_REGION_SIZE;
+	const tile_rect_t& regions = lightmap_regions;
+
+	for (int chunk_y = regions.y_begin - regions.y_begin % chunk_regions; chunk_y < regions.y_end; chunk_y += chunk_regions)
+	{
+		for (int chunk_x = regions.x_begin - regions.x_begin % chunk_regions; chunk_x < regions.x_end; chunk_x += chunk_regions)
+		{
+			for (int ry = std::max(chunk_y, regions.y_begin); ry < std::min(chunk_y + chunk_regions, regions.y_end); ++ry)
+			{
+				for (int rx = std::max(chunk_x, regions.x_begin); rx < std::min(chunk_x + chunk_regions, regions.x_end); ++rx)
+				{
+					const int region = ry * region_columns + rx;
+
+					// Regions of a streamed level stay dirty until their tiles are loaded
+					if (region_dirty[region] && requestTiles(getRegionRect(region)))
+					{
+						region_jobs.push_back(region);
+						region_dirty[region] = 0;
+					}
+				}
+			}
+		}
+	}
+
+	parallelFor((int)region_jobs.size(), [&](int job)
+	{
+		if (fixed_point_lighting)
+			composeRegion<fixed_lighting_t>(region_jobs[job]);
+		else
+			composeRegion<float_lighting_t>(region_jobs[job]);
+	});
+
+	enforceVisibilityBudget();
+
+	return (lightmap_moved || !region_jobs.empty());
+}
+
+void setLightingView(const tile_rect_t& view)
+{
+	lighting_view = view;
+}
+
+tile_rect_t getLightmapRect()
+{
+	return lightmap_rect;
+}
+
+const uint32_t* getLightmap()
+{
+	return (lightmap.empty() ? nullptr : &lightmap[0]);
+}
+
+void lightLevel(visibility_mode_t mode)
+{
+	invalidateLighting();
+	updateLighting(mode);
+}
+
+void freeLighting()
+{
+	cache_valid = false;
+	visibility_bytes = 0;
+	falloff_bytes = 0;
+
+	std::vector<light_cache_t>().swap(cached_lights);
+	std::vector<attenuation_table_t>().swap(attenuation_tables);
+	std::vector<int>().swap(dirty_lights);
+	std::vector<int>().swap(waiting_lights);
+	std::vector<uint8_t>().swap(region_dirty);
+	std::vector<std::vector<int>>().swap(region_lights);
+	std::vector<lighting_job_t>().swap(jobs);
+	std::vector<int>().swap(region_jobs);
+
+	lighting_view = tile_rect_t{ 0, 0, INT_MAX, INT_MAX };
+	lightmap_rect = tile_rect_t{ 0, 0, 0, 0 };
+	lightmap_regions = tile_rect_t{ 0, 0, 0, 0 };
+
+	std::vector<uint32_t>().swap(lightmap);
+	std::vector<uint32_t>().swap(moved_lightmap);
+}
+
+void setTile(int x, int y, int colour)
+{
+	lightmap[(y - lightmap_rect.y_begin) * (lightmap_rect.x_end - lightmap_rect.x_begin) + x - lightmap_rect.x_begin] = colour;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "level.h"
+#include "visibility.h"
+
+struct colour_t
+{
+	uint32_t r : 8;
+	uint32_t g : 8;
+	uint32_t b : 8;
+	uint32_t a : 8;
+};
+
+// Colour channels are from 0 to 1, and the attenuation at distance d is
+// 1 / (1 + linear * d + quadratic * d^2) with the default model in attenuation.h
+struct light_t
+{
+	glm::vec3 colour;
+	glm::vec2 pos;
+	float linear;
+	float quadratic;
+};
+
+const float DEFAULT_LINEAR_ATTENUATION = 0.1f;
+const float DEFAULT_QUADRATIC_ATTENUATION = 0.1f;
+
+// Distance at which a light of full brightness, a colour channel of 1, adds
+// less than 1/255, the smallest step of the 8-bit colour, nothing beyond it
+// gets any light
+// Culling there drops contributions below 1/255, so dense scenes where many
+// of them overlap can be slightly darker, a few steps in the worst case
+float getLightRadius(const light_t& light);
+
+// Tiles within a light's radius, clipped to the level, the only ones it is traced to and shades
+tile_rect_t getLightBounds(const light_t& light);
+
+// Loads lights from a text file, one per line as "x y r g b" with the colour
+// from 0 to 1, clamped to that so the radius holds for every light, optionally
+// followed by the linear and quadratic attenuation
+// Blank lines and lines starting with '#' are skipped
+// Returns false and leaves lights untouched if the file can't be read or has no lights
+bool loadLights(const char* filename, std::vector<light_t>* lights);
+
+// Width and height of the square regions of tiles that are relit and handed
+// to workers at a time, the same as the light grid's cells
+const int LIGHTING_REGION_SIZE = 16;
+
+// Brings the lightmap up to date with the light manager's lights, relighting
+// only what changed since the last call: lights that were added, removed, moved
+// or changed colour, and regions marked by invalidateLightingTile(), spread over
+// the thread pool
+// Each light keeps its visibility times attenuation at every tile, so one that
+// only changes colour just has its regions added up again with the new colour
+// The result is the same whatever the number of threads, returns false if no
+// pixel of the lightmap was touched
+bool updateLighting(visibility_mode_t mode);
+
+// Only the tiles of the view and LIGHTING_VIEW_MARGIN around it, rounded out to
+// whole regions, are lit and kept in the lightmap, the whole level until this
+// is first called
+// Lights outside it still light it if they reach it, and the parts of lights
+// beyond it are left to relight until the view gets to them
+// When the view moves the lightmap keeps the colours of the tiles it still
+// covers, so only the regions it newly covers are added up
+const int LIGHTING_VIEW_MARGIN = 16;
+
+void setLightingView(const tile_rect_t& view);
+
+// The tiles the lightmap covers, and their ABGR8888 colours row by row
+tile_rect_t getLightmapRect();
+const uint32_t* getLightmap();
+
+// Each light also keeps a bit per tile of what it sees between updates, so
+// a tile toggled in its shadow only means tracing the regions behind the tile
+// When they and the lights' falloff add up to more than this many bytes, the
+// bits of the lights that went longest without needing them are dropped until
+// they fit, then their falloff, which is worked out again when next needed
+const size_t DEFAULT_VISIBILITY_CACHE_BUDGET = 16 << 20;
+
+extern size_t visibility_cache_budget;
+
+// Bytes held by the lights' visibility bits, and by their falloff
+size_t getVisibilityCacheBytes();
+size_t getFalloffCacheBytes();
+
+// Lights with integers instead of floats: falloff and colours in fixed point,
+// sums that saturate at 16 bits and pixels taken from their top bytes
+// The result is the same on any compiler or CPU, and close to the float path's
+extern bool fixed_point_lighting;
+
+// Marks the tiles whose lighting can change when the tile at (x, y) is toggled
+// between wall and air, call after changing it
+void invalidateLightingTile(int x, int y);
+
+// Relights everything on the next updateLighting()
+void invalidateLighting();
+
+// Relights every tile of the lightmap from scratch
+void lightLevel(visibility_mode_t mode);
+
+void freeLighting();
+
+// Sets the colour of a tile in the lightmap, which must cover it
+void setTile(int x, int y, int colour);
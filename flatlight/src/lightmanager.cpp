@@ -0,0 +1,191 @@
+#include "lightmanager.h"
+
+// Lights
+std::vector<glm::vec2> light_positions;
+std::vector<glm::vec3> light_colours;
+std::vector<float> light_linear;
+std::vector<float> light_quadratic;
+std::vector<tile_rect_t> light_bounds;
+std::vector<uint8_t> light_active;
+
+// Slots of removed lights, reused by addLight()
+static std::vector<int> free_slots;
+
+static int light_count = 0;
+
+// A uniform grid over the level, each cell lists the lights whose bounds
+// reach it, and the lights standing on it, both sorted by id
+static int grid_columns = 0;
+static int grid_rows = 0;
+
+static std::vector<std::vector<int>> reach_cells;
+static std::vector<std::vector<int>> position_cells;
+
+// Adds a light to, or removes it from, every cell it is listed in
+static void gridLight(int id, bool insert)
+{
+	const tile_rect_t& bounds = light_bounds[id];
+
+	if (!isRectEmpty(bounds))
+	{
+		for (int cy = bounds.y_begin / LIGHT_CELL_SIZE; cy <= (bounds.y_end - 1) / LIGHT_CELL_SIZE; ++cy)
+		{
+			for (int cx = bounds.x_begin / LIGHT_CELL_SIZE; cx <= (bounds.x_end - 1) / LIGHT_CELL_SIZE; ++cx)
+			{
+				if (insert)
+					insertLightId(reach_cells[cy * grid_columns + cx], id);
+				else
+					eraseLightId(reach_cells[cy * grid_columns + cx], id);
+			}
+		}
+	}
+
+	// Lights off the level can't be picked
+	const int x = (int)light_positions[id].x;
+	const int y = (int)light_positions[id].y;
+
+	if (isInRect(getLevelRect(), x, y))
+	{
+		if (insert)
+			insertLightId(position_cells[getLightCell(x, y)], id);
+		else
+			eraseLightId(position_cells[getLightCell(x, y)], id);
+	}
+}
+
+void clearLights()
+{
+	freeLights();
+
+	grid_columns = (level_width + LIGHT_CELL_SIZE - 1) / LIGHT_CELL_SIZE;
+	grid_rows = (level_height + LIGHT_CELL_SIZE - 1) / LIGHT_CELL_SIZE;
+
+	reach_cells.resize(grid_columns * grid_rows);
+	position_cells.resize(grid_columns * grid_rows);
+}
+
+void freeLights()
+{
+	std::vector<glm::vec2>().swap(light_positions);
+	std::vector<glm::vec3>().swap(light_colours);
+	std::vector<float>().swap(light_linear);
+	std::vector<float>().swap(light_quadratic);
+	std::vector<tile_rect_t>().swap(light_bounds);
+	std::vector<uint8_t>().swap(light_active);
+	std::vector<int>().swap(free_slots);
+
+	std::vector<std::vector<int>>().swap(reach_cells);
+	std::vector<std::vector<int>>().swap(position_cells);
+
+	light_count = 0;
+}
+
+int getLightCount()
+{
+	return light_count;
+}
+
+int addLight(const light_t& light)
+{
+	int id;
+
+	if (!free_slots.empty())
+	{
+		id = free_slots.back();
+		free_slots.pop_back();
+	}
+	else
+	{
+		id = getLightSlotCount();
+
+		light_positions.push_back(glm::vec2());
+		light_colours.push_back(glm::vec3());
+		light_linear.push_back(0.0f);
+		light_quadratic.push_back(0.0f);
+		light_bounds.push_back(tile_rect_t{ 0, 0, 0, 0 });
+		light_active.push_back(0);
+	}
+
+	light_positions[id] = light.pos;
+	light_colours[id] = light.colour;
+	light_linear[id] = light.linear;
+	light_quadratic[id] = light.quadratic;
+	light_bounds[id] = getLightBounds(light);
+	light_active[id] = 1;
+
+	gridLight(id, true);
+
+	light_count++;
+
+	return id;
+}
+
+void removeLight(int id)
+{
+	if (id < 0 || id >= getLightSlotCount() || !light_active[id])
+		return;
+
+	gridLight(id, false);
+
+	light_active[id] = 0;
+	free_slots.push_back(id);
+
+	light_count--;
+}
+
+void moveLight(int id, glm::vec2 pos)
+{
+	if (light_positions[id] == pos)
+		return;
+
+	gridLight(id, false);
+
+	light_positions[id] = pos;
+	light_bounds[id] = getLightBounds(getLight(id));
+
+	gridLight(id, true);
+}
+
+void setLightColour(int id, glm::vec3 colour)
+{
+	light_colours[id] = colour;
+}
+
+light_t getLight(int id)
+{
+	return light_t{ light_colours[id], light_positions[id], light_linear[id], light_quadratic[id] };
+}
+
+int findLightAt(int x, int y)
+{
+	if (!isInRect(getLevelRect(), x, y))
+		return -1;
+
+	// The highest id wins when lights share a tile
+	const std::vector<int>& ids = position_cells[getLightCell(x, y)];
+
+	int found = -1;
+
+	for (size_t i = 0; i < ids.size(); ++i)
+	{
+		if ((int)light_positions[ids[i]].x == x && (int)light_positions[ids[i]].y == y)
+			found = ids[i];
+	}
+
+	return found;
+}
+
+int getLightCell(int x, int y)
+{
+	return (y / LIGHT_CELL_SIZE) * grid_columns + x / LIGHT_CELL_SIZE;
+}
+
+int getLightCellCount()
+{
+	return grid_columns * grid_rows;
+}
+
+const std::vector<int>& getLightsReachingCell(int cell)
+{
+	return reach_cells[cell];
+}
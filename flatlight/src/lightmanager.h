@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "level.h"
+#include "lighting.h"
+
+// Width and height of the cells of the light grid, in tiles, the same as the
+// lighting regions so each region can use its cell's list of lights
+const int LIGHT_CELL_SIZE = LIGHTING_REGION_SIZE;
+
+// Lights in the scene, stored as structure of arrays indexed by light id
+// Removed lights leave their slot inactive until addLight() reuses it, so ids
+// stay the same for as long as a light exists
+extern std::vector<glm::vec2> light_positions;
+extern std::vector<glm::vec3> light_colours;
+extern std::vector<float> light_linear;
+extern std::vector<float> light_quadratic;
+extern std::vector<tile_rect_t> light_bounds;
+extern std::vector<uint8_t> light_active;
+
+// Number of light slots, active or not, ids are below this
+inline int getLightSlotCount()
+{
+	return (int)light_active.size();
+}
+
+// Add an id to, or remove it from, a list of light ids kept in increasing order
+inline void insertLightId(std::vector<int>& ids, int id)
+{
+	ids.insert(std::lower_bound(ids.begin(), ids.end(), id), id);
+}
+
+inline void eraseLightId(std::vector<int>& ids, int id)
+{
+	std::vector<int>::iterator it = std::lower_bound(ids.begin(), ids.end(), id);
+
+	if (it != ids.end() && *it == id)
+		ids.erase(it);
+}
+
+// Removes every light and sizes the light grid to the level, call after loading it
+void clearLights();
+void freeLights();
+
+int getLightCount();
+
+// Returns the new light's id
+int addLight(const light_t& light);
+void removeLight(int id);
+
+void moveLight(int id, glm::vec2 pos);
+void setLightColour(int id, glm::vec3 colour);
+
+light_t getLight(int id);
+
+// Returns the id of the light on a tile, or -1 if there is none
+int findLightAt(int x, int y);
+
+// Cell of the light grid a tile is in, the grid covers the level
+int getLightCell(int x, int y);
+int getLightCellCount();
+
+// Ids, in increasing order, of the lights whose bounds reach a cell
+const std::vector<int>& getLightsReachingCell(int cell);
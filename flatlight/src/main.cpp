@@ -2,30 +2,29 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <vector>
 #include <glm/glm.hpp>
 
 #include <SDL2/SDL.h>
 #undef main
 
-struct colour_t
-{
-	uint32_t r : 8;
-	uint32_t g : 8;
-	uint32_t b : 8;
-	uint32_t a : 8;
-};
-
-struct light_t
-{
-	glm::vec3 colour;
-	glm::vec2 pos;
-};
+#include "headless.h"
+#include "level.h"
+#include "levelfile.h"
+#include "levelstream.h"
+#include "lighting.h"
+#include "lightmanager.h"
+#include "simd.h"
+#include "threadpool.h"
+#include "visibility.h"
 
 void pause();
 void createWindow(int width, int height, SDL_Window** window, SDL_Renderer** renderer);
 void loadLevel(const char* filename, char** level, int* level_width, int* level_height);
-void setTile(uint32_t* pixels, int x, int y, int colour);
-bool raycast(int startx, int starty, int endx, int endy);
+void clampCamera();
+void zoomCamera(float factor, int screen_x, int screen_y);
+tile_rect_t getViewRect();
+void screenToTile(int screen_x, int screen_y, int* tile_x, int* tile_y);
 
 // Constants
 const char* LEVEL_FILENAME = "level.txt";
@@ -36,46 +35,219 @@ const int TILE_HEIGHT = 16;
 const int INITIAL_WIDTH = 800;
 const int INITIAL_HEIGHT = 600;
 
+// Largest window, the camera scrolls and zooms around levels bigger than it
+const int MAX_WINDOW_WIDTH = 1280;
+const int MAX_WINDOW_HEIGHT = 960;
+
+// Window pixels an arrow key pans the camera by, and how far it zooms in and out
+const int CAMERA_PAN_PIXELS = 64;
+const float MIN_CAMERA_ZOOM = 1.0f / 16.0f;
+const float MAX_CAMERA_ZOOM = 4.0f;
+
+// Level and light files, the lights default to the set below
+const char* level_filename = LEVEL_FILENAME;
+const char* lights_filename = nullptr;
+
+// Headless mode renders a number of frames without a window, prints their
+// timings, and writes the last one to an image file
+bool headless = false;
+int headless_frames = 100;
+const char* output_filename = nullptr;
+
+// Tiles lit in headless mode, the whole level if empty
+tile_rect_t headless_view{ 0, 0, 0, 0 };
+
+// Writes the level to a binary level file and exits, to convert text levels
+const char* convert_filename = nullptr;
+
+// Streams a binary level's chunks in as they are needed instead of loading it whole
+bool stream_level = false;
+
 // Window width and height
 int width = INITIAL_WIDTH;
 int height = INITIAL_HEIGHT;
 
-// Colour buffer
-uint32_t* pixels;
+// Camera, the level position in tiles at the top left of the window, and how
+// many times TILE_WIDTH by TILE_HEIGHT pixels a tile is drawn
+glm::vec2 camera_pos(0.0f, 0.0f);
+float camera_zoom = 1.0f;
 
-// Level width, height, and buffer
-int level_width;
-int level_height;
-char* level;
+// Worker threads for lighting, the default is one per CPU
+int thread_count = 0;
 
-// Default light settings
-light_t lights[] =
+// Visibility method
+visibility_mode_t visibility_mode = VISIBILITY_SHADOWCAST;
+
+// Default light settings, added to the light manager at startup
+std::vector<light_t> lights =
 {
-	light_t{ glm::vec3(1.0f, 0.0f, 0.0f), glm::ivec2(28, 9) },
-	light_t{ glm::vec3(0.0f, 1.0f, 0.0f), glm::ivec2(53, 10) },
-	light_t{ glm::vec3(0.0f, 0.0f, 1.0f), glm::ivec2(14, 34) },
-	light_t{ glm::vec3(1.0f, 1.0f, 1.0f), glm::ivec2(34, 31) }
+	light_t{ glm::vec3(1.0f, 0.0f, 0.0f), glm::ivec2(28, 9), DEFAULT_LINEAR_ATTENUATION, DEFAULT_QUADRATIC_ATTENUATION },
+	light_t{ glm::vec3(0.0f, 1.0f, 0.0f), glm::ivec2(53, 10), DEFAULT_LINEAR_ATTENUATION, DEFAULT_QUADRATIC_ATTENUATION },
+	light_t{ glm::vec3(0.0f, 0.0f, 1.0f), glm::ivec2(14, 34), DEFAULT_LINEAR_ATTENUATION, DEFAULT_QUADRATIC_ATTENUATION },
+	light_t{ glm::vec3(1.0f, 1.0f, 1.0f), glm::ivec2(34, 31), DEFAULT_LINEAR_ATTENUATION, DEFAULT_QUADRATIC_ATTENUATION }
 };
 
-const int LIGHT_COUNT = sizeof(lights) / sizeof(light_t);
-
 int main(int argc, char** argv)
 {
 	// State
 	bool running = true;
 	int cur_light = -1;
 
+	// Last mouse position, the wheel zooms around it
+	int mouse_x = 0;
+	int mouse_y = 0;
+
 	// Window references
 	SDL_Window* window;
 	SDL_Renderer* renderer;
-	SDL_Texture* texture;
+	SDL_Texture* texture = nullptr;
+
+	// Size of the render texture, made to fit the lightmap
+	int texture_width = 0;
+	int texture_height = 0;
+
+	// Parse arguments
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--visibility") == 0 && i + 1 < argc)
+		{
+			if (!parseVisibilityMode(argv[++i], &visibility_mode))
+			{
+				fprintf(stderr, "Unknown visibility mode: %s\n", argv[i]);
+
+				pause();
+
+				exit(1);
+			}
+		}
+		else if (strcmp(argv[i], "--polar-bins") == 0 && i + 1 < argc)
+		{
+			polar_bins = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--visibility-budget") == 0 && i + 1 < argc)
+		{
+			visibility_cache_budget = (size_t)atoi(argv[++i]) << 10;
+		}
+		else if (strcmp(argv[i], "--fixed-point") == 0)
+		{
+			fixed_point_lighting = true;
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			thread_count = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--no-avx2") == 0)
+		{
+			use_avx2 = false;
+		}
+		else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc)
+		{
+			level_filename = argv[++i];
+		}
+		else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+		{
+			lights_filename = argv[++i];
+		}
+		else if (strcmp(argv[i], "--headless") == 0)
+		{
+			headless = true;
+		}
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+		{
+			headless_frames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+		{
+			output_filename = argv[++i];
+		}
+		else if (strcmp(argv[i], "--view") == 0 && i + 4 < argc)
+		{
+			headless_view.x_begin = atoi(argv[++i]);
+			headless_view.y_begin = atoi(argv[++i]);
+			headless_view.x_end = headless_view.x_begin + atoi(argv[++i]);
+			headless_view.y_end = headless_view.y_begin + atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--convert-level") == 0 && i + 1 < argc)
+		{
+			convert_filename = argv[++i];
+		}
+		else if (strcmp(argv[i], "--stream") == 0)
+		{
+			stream_level = true;
+		}
+		else if (strcmp(argv[i], "--stream-budget") == 0 && i + 1 < argc)
+		{
+			level_stream_budget = (size_t)atoi(argv[++i]) << 10;
+		}
+	}
 
 	// Load level
-	loadLevel(LEVEL_FILENAME, &level, &level_width, &level_height);
+	loadLevel(level_filename, &level, &level_width, &level_height);
+
+	if (convert_filename != nullptr)
+	{
+		const bool written = writeLevelFile(convert_filename, level, level_width, level_height);
+
+		if (written)
+			printf("Wrote %s\n", convert_filename);
+
+		freeLevel(level);
+
+		return (written ? 0 : 1);
+	}
+
+	buildLevelChunks();
+	buildOccupancy();
+	buildWallSegments();
 
-	// Set window size based on level size
-	width = level_width * TILE_WIDTH;
-	height = level_height * TILE_HEIGHT;
+	// Load lights
+	if (lights_filename != nullptr && !loadLights(lights_filename, &lights))
+	{
+		pause();
+
+		exit(1);
+	}
+
+	// Hand them to the light manager
+	clearLights();
+
+	for (size_t i = 0; i < lights.size(); ++i)
+		addLight(lights[i]);
+
+	// Start worker threads
+	if (thread_count < 1)
+		thread_count = SDL_GetCPUCount();
+
+	startThreadPool(thread_count);
+
+	printf("Lighting threads: %d\n", getThreadCount());
+
+	// Render without SDL video and exit
+	if (headless)
+	{
+		if (!isRectEmpty(headless_view))
+			setLightingView(headless_view);
+
+		int result = runHeadless(visibility_mode, headless_frames, output_filename);
+
+		stopThreadPool();
+		freeLighting();
+		freeLights();
+
+		freeOccupancy();
+		closeLevelStream();
+		freeLevelChunks();
+		freeLevel(level);
+
+		return result;
+	}
+
+	// Frames since the worker stats were last printed
+	int stats_frames = 0;
+
+	// Set window size based on level size, up to the largest window
+	width = glm::min(level_width * TILE_WIDTH, MAX_WINDOW_WIDTH);
+	height = glm::min(level_height * TILE_HEIGHT, MAX_WINDOW_HEIGHT);
 
 	// Initialise SDL
 	SDL_Init(SDL_INIT_VIDEO);
@@ -83,13 +255,6 @@ int main(int argc, char** argv)
 	// Create window
 	createWindow(width, height, &window, &renderer);
 
-	// Create render texture
-	texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888,
-		SDL_TEXTUREACCESS_STATIC, level_width, level_height);
-
-	// Create colour buffer
-	pixels = new uint32_t[level_width * level_height];
-
 	// Main loop
 	while (running)
 	{
@@ -105,46 +270,152 @@ int main(int argc, char** argv)
 				{
 					running = false;
 				}
+				else if (e.key.state == SDL_PRESSED && e.key.keysym.scancode == SDL_SCANCODE_V)
+				{
+					// Switch to the next visibility mode
+					visibility_mode = (visibility_mode_t)((visibility_mode + 1) % VISIBILITY_MODE_COUNT);
+
+					printf("Visibility mode: %s\n", getVisibilityModeName(visibility_mode));
+				}
+				else if (e.key.state == SDL_PRESSED && e.key.keysym.scancode == SDL_SCANCODE_C)
+				{
+					// Compare the current visibility mode against raycast(), which
+					// needs every tile of the level in memory
+					if (isLevelStreamed())
+					{
+						printf("Can't compare visibility modes on a streamed level\n");
+						break;
+					}
+
+					int mismatches = 0;
+
+					for (int i = 0; i < getLightSlotCount(); ++i)
+					{
+						if (!light_active[i])
+							continue;
+
+						mismatches += compareVisibility(VISIBILITY_RAYCAST, visibility_mode,
+							(int)light_positions[i].x, (int)light_positions[i].y);
+					}
+
+					printf("%d tiles differ between %s and %s\n", mismatches,
+						getVisibilityModeName(VISIBILITY_RAYCAST), getVisibilityModeName(visibility_mode));
+				}
+				else if (e.key.state == SDL_PRESSED && e.key.keysym.scancode == SDL_SCANCODE_T)
+				{
+					// Print and reset the per-worker timings
+					printWorkerStats(stats_frames);
+					resetWorkerStats();
+
+					stats_frames = 0;
+				}
+				else if (e.key.state == SDL_PRESSED && (e.key.keysym.scancode == SDL_SCANCODE_LEFT ||
+					e.key.keysym.scancode == SDL_SCANCODE_RIGHT || e.key.keysym.scancode == SDL_SCANCODE_UP ||
+					e.key.keysym.scancode == SDL_SCANCODE_DOWN))
+				{
+					// Pan the camera
+					const float pan_x = CAMERA_PAN_PIXELS / (TILE_WIDTH * camera_zoom);
+					const float pan_y = CAMERA_PAN_PIXELS / (TILE_HEIGHT * camera_zoom);
+
+					if (e.key.keysym.scancode == SDL_SCANCODE_LEFT)
+						camera_pos.x -= pan_x;
+					else if (e.key.keysym.scancode == SDL_SCANCODE_RIGHT)
+						camera_pos.x += pan_x;
+					else if (e.key.keysym.scancode == SDL_SCANCODE_UP)
+						camera_pos.y -= pan_y;
+					else
+						camera_pos.y += pan_y;
+
+					clampCamera();
+				}
+				else if (e.key.state == SDL_PRESSED && (e.key.keysym.scancode == SDL_SCANCODE_EQUALS ||
+					e.key.keysym.scancode == SDL_SCANCODE_KP_PLUS))
+				{
+					// Zoom in and out around the middle of the window
+					zoomCamera(2.0f, width / 2, height / 2);
+				}
+				else if (e.key.state == SDL_PRESSED && (e.key.keysym.scancode == SDL_SCANCODE_MINUS ||
+					e.key.keysym.scancode == SDL_SCANCODE_KP_MINUS))
+				{
+					zoomCamera(0.5f, width / 2, height / 2);
+				}
+				break;
+			case SDL_MOUSEWHEEL:
+				// Zoom in and out around the mouse
+				if (e.wheel.y != 0)
+					zoomCamera((e.wheel.y > 0 ? 2.0f : 0.5f), mouse_x, mouse_y);
 				break;
 			case SDL_MOUSEBUTTONDOWN:
 				if (e.button.button == SDL_BUTTON_LEFT)
 				{
-					int tile_x = e.button.x / TILE_WIDTH;
-					int tile_y = e.button.y / TILE_HEIGHT;
+					int tile_x, tile_y;
+					screenToTile(e.button.x, e.button.y, &tile_x, &tile_y);
+
+					// A streamed tile can only be changed once it is loaded, and then stays loaded
+					if (!isInRect(getLevelRect(), tile_x, tile_y) || !requestTiles(tile_rect_t{ tile_x, tile_y, tile_x + 1, tile_y + 1 }))
+						break;
 
-					char tile = level[tile_y * level_width + tile_x];
+					char tile = getTile(tile_x, tile_y);
 
 					if (tile == '#')
-						level[tile_y * level_width + tile_x] = '%';
+						setLevelTile(tile_x, tile_y, '%');
 					else
-						level[tile_y * level_width + tile_x] = '#';
+						setLevelTile(tile_x, tile_y, '#');
+
+					keepTileLoaded(tile_x, tile_y);
+
+					// Only the lighting this tile can reach needs redoing
+					invalidateLightingTile(tile_x, tile_y);
 				}
 				else if (e.button.button == SDL_BUTTON_RIGHT)
 				{
-					int tile_x = e.button.x / TILE_WIDTH;
-					int tile_y = e.button.y / TILE_HEIGHT;
+					int tile_x, tile_y;
+					screenToTile(e.button.x, e.button.y, &tile_x, &tile_y);
 
-					cur_light = -1;
+					cur_light = findLightAt(tile_x, tile_y);
+				}
+				else if (e.button.button == SDL_BUTTON_MIDDLE)
+				{
+					int tile_x, tile_y;
+					screenToTile(e.button.x, e.button.y, &tile_x, &tile_y);
+
+					if (!isInRect(getLevelRect(), tile_x, tile_y))
+						break;
 
-					for (int i = 0; i < LIGHT_COUNT; ++i)
+					// Remove the light on the tile, or add a white one if there is none
+					int id = findLightAt(tile_x, tile_y);
+
+					if (id != -1)
+					{
+						removeLight(id);
+
+						printf("Light removed: (%d, %d), %d lights\n", tile_x, tile_y, getLightCount());
+					}
+					else
 					{
-						if (tile_x == lights[i].pos.x && tile_y == lights[i].pos.y)
-							cur_light = i;
+						addLight(light_t{ glm::vec3(1.0f, 1.0f, 1.0f), glm::vec2(tile_x, tile_y),
+							DEFAULT_LINEAR_ATTENUATION, DEFAULT_QUADRATIC_ATTENUATION });
+
+						printf("Light added: (%d, %d), %d lights\n", tile_x, tile_y, getLightCount());
 					}
 				}
 				break;
 			case SDL_MOUSEMOTION:
+				mouse_x = e.motion.x;
+				mouse_y = e.motion.y;
+
 				if (cur_light != -1)
 				{
-					int tile_x = e.motion.x / TILE_WIDTH;
-					int tile_y = e.motion.y / TILE_HEIGHT;
+					int tile_x, tile_y;
+					screenToTile(e.motion.x, e.motion.y, &tile_x, &tile_y);
 
-					lights[cur_light].pos = glm::ivec2(tile_x, tile_y);
+					if (isInRect(getLevelRect(), tile_x, tile_y))
+						moveLight(cur_light, glm::vec2(tile_x, tile_y));
 				}
 			case SDL_MOUSEBUTTONUP:
-				if (e.button.button == SDL_BUTTON_RIGHT)
+				if (e.button.button == SDL_BUTTON_RIGHT && cur_light != -1)
 				{
-					printf("Light dropped: (%f, %f)\n", lights[cur_light].pos.x, lights[cur_light].pos.y);
+					printf("Light dropped: (%f, %f)\n", light_positions[cur_light].x, light_positions[cur_light].y);
 					
 					cur_light = -1;
 				}
@@ -155,88 +426,84 @@ int main(int argc, char** argv)
 			}
 		}
 
-		// Clear screen to 0 (black)
-		memset(pixels, 0, level_width * level_height * sizeof(uint32_t));
+		// Put the chunks of a streamed level read since the last frame in place
+		updateLevelStream();
 
-		// Render
-		for (int y = 0; y < level_height; ++y)
-		{
-			for (int x = 0; x < level_width; ++x)
-			{
-				switch (level[y * level_width + x])
-				{
-				case '#':
-					// Wall
-					setTile(pixels, x, y, 0x808080);
-					break;
-				default:
-					// Air
-					glm::vec3 tile_col;
-
-					// Check lighting
-					// For each light
-					for (int i = 0; i < LIGHT_COUNT; ++i)
-					{
-						const light_t& light = lights[i];
+		// Light what is in view, relighting whatever changed since the last frame
+		const tile_rect_t view = getViewRect();
 
-						if (!raycast(light.pos.x, light.pos.y, x, y))
-						{
-							float diffx = x - light.pos.x;
-							float diffy = y - light.pos.y;
+		setLightingView(view);
 
-							float dist = sqrt(diffx * diffx + diffy * diffy);
+		bool updated = updateLighting(visibility_mode);
 
-							const float a = 0.1f;
-							const float b = 0.1f;
+		const tile_rect_t lightmap_rect = getLightmapRect();
 
-							float att = 1.0f / (1.0f + a*dist + b*dist*dist);
+		const int lightmap_width = lightmap_rect.x_end - lightmap_rect.x_begin;
+		const int lightmap_height = lightmap_rect.y_end - lightmap_rect.y_begin;
 
-							tile_col += light.colour * att;
-						}
-					}
+		// The lightmap changes size as the camera zooms
+		if (lightmap_width != texture_width || lightmap_height != texture_height)
+		{
+			if (texture != nullptr)
+				SDL_DestroyTexture(texture);
 
-					// Clamp and convert to colour
-					tile_col = glm::clamp(tile_col, 0.0f, 1.0f);
+			texture = (isRectEmpty(lightmap_rect) ? nullptr : SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888,
+				SDL_TEXTUREACCESS_STATIC, lightmap_width, lightmap_height));
 
-					glm::vec3 tile_col_255 = tile_col * 255.0f;
+			texture_width = lightmap_width;
+			texture_height = lightmap_height;
 
-					colour_t final_tile_col{(uint8_t)tile_col_255.r,
-											(uint8_t)tile_col_255.g,
-											(uint8_t)tile_col_255.b,
-											1.0f };
+			updated = true;
+		}
 
-					setTile(pixels, x, y, *(uint32_t*)&final_tile_col);
+		// Update the render texture from the lightmap if any of it changed
+		if (updated && texture != nullptr)
+			SDL_UpdateTexture(texture, nullptr, getLightmap(), lightmap_width * sizeof(uint32_t));
 
-					break;
-				}
-			}
-		}
+		// Then read ahead around what is in view, and the lights that reach near it
+		prefetchTiles(expandRect(view, LEVEL_STREAM_PREFETCH_MARGIN));
+		prefetchLightTiles(view);
+
+		stats_frames++;
 
-		// Update render texture from colour buffer
-		SDL_UpdateTexture(texture, nullptr, pixels, level_width * sizeof(uint32_t));
+		// The tiles in view, from the lightmap to where the camera puts them in the window
+		const float tile_width = TILE_WIDTH * camera_zoom;
+		const float tile_height = TILE_HEIGHT * camera_zoom;
 
 		SDL_Rect src_rect;
 		SDL_Rect dest_rect;
 
-		src_rect.x = 0;
-		src_rect.y = 0;
-		src_rect.w = level_width;
-		src_rect.h = level_height;
+		src_rect.x = view.x_begin - lightmap_rect.x_begin;
+		src_rect.y = view.y_begin - lightmap_rect.y_begin;
+		src_rect.w = view.x_end - view.x_begin;
+		src_rect.h = view.y_end - view.y_begin;
 
-		dest_rect.x = 0;
-		dest_rect.y = 0;
-		dest_rect.w = width;
-		dest_rect.h = height;
+		dest_rect.x = (int)floor((view.x_begin - camera_pos.x) * tile_width + 0.5f);
+		dest_rect.y = (int)floor((view.y_begin - camera_pos.y) * tile_height + 0.5f);
+		dest_rect.w = (int)floor((view.x_end - camera_pos.x) * tile_width + 0.5f) - dest_rect.x;
+		dest_rect.h = (int)floor((view.y_end - camera_pos.y) * tile_height + 0.5f) - dest_rect.y;
 
 		// Render to window
 		SDL_RenderClear(renderer);
-		SDL_RenderCopy(renderer, texture, &src_rect, &dest_rect);
+
+		if (texture != nullptr)
+			SDL_RenderCopy(renderer, texture, &src_rect, &dest_rect);
+
 		SDL_RenderPresent(renderer);
 	}
 
 	// Clean up SDL and exit program
-	delete[] pixels;
-	SDL_DestroyTexture(texture);
+	stopThreadPool();
+	freeLighting();
+	freeLights();
+	freeOccupancy();
+	closeLevelStream();
+	freeLevelChunks();
+	freeLevel(level);
+
+	if (texture != nullptr)
+		SDL_DestroyTexture(texture);
+
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
@@ -246,6 +513,10 @@ int main(int argc, char** argv)
 
 void pause()
 {
+	// Nobody is there to press return in headless mode
+	if (headless)
+		return;
+
 	// Pause and wait for input
 	printf("\nPress return to continue\n");
 	getchar();
@@ -256,7 +527,7 @@ void createWindow(int width, int height, SDL_Window** window, SDL_Renderer** ren
 	SDL_SetHint(SDL_HINT_RENDER_VSYNC, 0);
 
 	// Create window
-	*window = SDL_CreateWindow("flatlight - place tiles with left click and drag lights with right",
+	*window = SDL_CreateWindow("flatlight - place tiles with left click, drag lights with right, scroll with the arrow keys and zoom with the wheel",
 							   SDL_WINDOWPOS_UNDEFINED,
 							   SDL_WINDOWPOS_UNDEFINED,
 							   width,
@@ -279,171 +550,67 @@ void createWindow(int width, int height, SDL_Window** window, SDL_Renderer** ren
 
 void loadLevel(const char* filename, char** level, int* level_width, int* level_height)
 {
-	char buf[1024];
+	// Binary level files are used in place or streamed, text ones are read into a new buffer
+	bool loaded;
 
-	int width, height;
-
-	// Open file
-	FILE* file = fopen(filename, "r");
-
-	if (file == nullptr)
+	if (!isLevelFile(filename))
 	{
-		fprintf(stderr, "Failed to open file for reading: %s\n", filename);
+		if (stream_level)
+			printf("Only binary levels can be streamed, reading %s whole\n", filename);
 
-		pause();
-
-		exit(1);
+		loaded = readTextLevel(filename, level, level_width, level_height);
 	}
-
-	// Get length of first line for width
-	char* line = fgets(buf, 1024, file);
-
-	if (line == nullptr)
+	else if (stream_level && convert_filename == nullptr)
 	{
-		*level = nullptr;
-		*level_width = 0;
-		*level_height = 0;
-
-		return;
+		loaded = openLevelStream(filename);
 	}
-
-	// Get width
-	width = strlen(line);
-
-	// Remove newline from width if existent
-	if (line[width - 1] = '\n')
-		width--;
-
-	// Initialise height to 1 because we already read a line
-	height = 1;
-
-	// Read the rest of the lines to get height
-	while (fgets(buf, 1024, file))
+	else
 	{
-		height++;
+		loaded = mapLevelFile(filename, level, level_width, level_height);
 	}
 
-	// Rewind the file for reading
-	fseek(file, 0, SEEK_SET);
-
-	// Initialise arrays
-	*level = new char[width * height];
-	*level_width = width;
-	*level_height = height;
-
-	// Load level
-	int y = 0;
-	while (line = fgets(buf, 1024, file))
+	if (!loaded)
 	{
-		// Get length of line
-		int length = strlen(line);
-
-		// Remove newline from length if existent
-		if (line[length - 1] == '\n')
-			length--;
-
-		// If length isn't the same as width, quit
-		if (length != width)
-		{
-			fprintf(stderr, "Length of line differs from width %d (l = %d, w = %d)\n", y, length, width);
-
-			pause();
-
-			exit(1);
-		}
-
-		// Copy to array
-		memcpy(&(*level)[y * width], buf, length);
+		pause();
 
-		// Increment y
-		y++;
+		exit(1);
 	}
-
-	// Output stats
-	printf("Level height: %d, level width: %d\n", height, width);
 }
 
-void setTile(uint32_t* pixels, int x, int y, int colour)
+void clampCamera()
 {
-	pixels[y * level_width + x] = colour;
+	// Keep the window over the level, or at its top left if the level is smaller
+	const float view_width = width / (TILE_WIDTH * camera_zoom);
+	const float view_height = height / (TILE_HEIGHT * camera_zoom);
+
+	camera_pos.x = glm::clamp(camera_pos.x, 0.0f, glm::max(level_width - view_width, 0.0f));
+	camera_pos.y = glm::clamp(camera_pos.y, 0.0f, glm::max(level_height - view_height, 0.0f));
 }
 
-// A fast raycast that skips to the next tile along the ray in a grid
-// An implementation of John Amanatides (1987) - A fast voxel traversal algorithm for ray tracing
-bool raycast(int startx, int starty, int endx, int endy)
+void zoomCamera(float factor, int screen_x, int screen_y)
 {
-	// Hit if the start tile is obstructed
-	if (level[starty * level_width + startx] == '#')
-	{
-		return true;
-	}
+	const float zoom = glm::clamp(camera_zoom * factor, MIN_CAMERA_ZOOM, MAX_CAMERA_ZOOM);
 
-	// No hit if the start tile is the end tile
-	if (startx == endx && starty == endy)
-	{
-		return false;
-	}
-
-	float diffx = endx - startx;
-	float diffy = endy - starty;
-
-	float length = sqrt(diffx * diffx + diffy * diffy);
-
-	float dx = diffx / length;
-	float dy = diffy / length;
-
-	if (abs(dx) < 0.0001f)
-		dx = 0.0001f;
-	if (abs(dy) < 0.0001f)
-		dy = 0.0001f;
+	// Keep the level position under (screen_x, screen_y) where it is
+	camera_pos.x += screen_x / (float)TILE_WIDTH * (1.0f / camera_zoom - 1.0f / zoom);
+	camera_pos.y += screen_y / (float)TILE_HEIGHT * (1.0f / camera_zoom - 1.0f / zoom);
 
-	int cur_tile_x = startx;
-	int cur_tile_y = starty;
-
-	// Calculate coefficient and bias for tx, ty calculation
-	// The calculation is tx = (x - x0) / dx, ty = (y - y0) / dy
-	// Which is derived from x = x0 + tdx, y = y0 + ydx
-	// And can then be simplified to a multiply add
-	// tx = x * (1/dx) + (- x0 / dx)
-	// or tx = x * dx_coeff + dx_bias
-	const float dx_coeff = 1.0f / dx;
-	const float dy_coeff = 1.0f / dy;
-
-	const float dx_bias = -(startx / dx);
-	const float dy_bias = -(starty / dy);
-
-	int dx_step = (dx > 0 ? 1 : -1);
-	int dy_step = (dy > 0 ? 1 : -1);
-
-	float t = 0;
-
-	while (t < length)
-	{
-		int next_x = cur_tile_x + dx_step;
-		int next_y = cur_tile_y + dy_step;
+	camera_zoom = zoom;
 
-		// Calculate next tx and ty value
-		float tx = next_x * dx_coeff + dx_bias;
-		float ty = next_y * dy_coeff + dy_bias;
+	clampCamera();
+}
 
-		if (tx < ty)
-		{
-			cur_tile_x = next_x;
-			t = tx;
-		}
-		else
-		{
-			cur_tile_y = next_y;
-			t = ty;
-		}
+tile_rect_t getViewRect()
+{
+	// Tiles at least partly in the window
+	const tile_rect_t view{ (int)floor(camera_pos.x), (int)floor(camera_pos.y),
+		(int)ceil(camera_pos.x + width / (TILE_WIDTH * camera_zoom)), (int)ceil(camera_pos.y + height / (TILE_HEIGHT * camera_zoom)) };
 
-		// If tile blocked, return true (hit)
-		if (level[cur_tile_y * level_width + cur_tile_x] == '#')
-		{
-			return true;
-		}
-	}
+	return intersectRects(view, getLevelRect());
+}
 
-	// Made it to (endx, endy), return false (hit)
-	return false;
+void screenToTile(int screen_x, int screen_y, int* tile_x, int* tile_y)
+{
+	*tile_x = (int)floor(camera_pos.x + screen_x / (TILE_WIDTH * camera_zoom));
+	*tile_y = (int)floor(camera_pos.y + screen_y / (TILE_HEIGHT * camera_zoom));
 }
@@ -0,0 +1,284 @@
+#include "pack.h"
+
+#include "lighting.h"
+#include "simd.h"
+
+#include <string.h>
+
+#include <immintrin.h>
+
+// Packs one tile the same way the per-tile lighting loop always has
+static inline uint32_t packColour(float red, float green, float blue)
+{
+	glm::vec3 tile_col = glm::clamp(glm::vec3(red, green, blue), 0.0f, 1.0f);
+
+	glm::vec3 tile_col_255 = tile_col * 255.0f;
+
+	colour_t final_tile_col{(uint8_t)tile_col_255.r,
+							(uint8_t)tile_col_255.g,
+							(uint8_t)tile_col_255.b,
+							255 };
+
+	uint32_t pixel;
+	memcpy(&pixel, &final_tile_col, sizeof(pixel));
+
+	return pixel;
+}
+
+// Colours only go through max, min, a multiply and a truncating conversion,
+// each of which the vector versions do exactly as the scalar code does
+static inline __m128i packChannelsSSE2(__m128 red, __m128 green, __m128 blue)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(255.0f);
+
+	__m128i r = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(red, zero), one), scale));
+	__m128i g = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(green, zero), one), scale));
+	__m128i b = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(blue, zero), one), scale));
+
+	return _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(b, 16), _mm_set1_epi32((int)0xff000000)));
+}
+
+static void packColoursSSE2(const float* red, const float* green, const float* blue, uint32_t* out, int count)
+{
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i pixels = packChannelsSSE2(_mm_loadu_ps(&red[i]), _mm_loadu_ps(&green[i]), _mm_loadu_ps(&blue[i]));
+
+		_mm_storeu_si128((__m128i*)&out[i], pixels);
+	}
+
+	for (; i < count; ++i)
+		out[i] = packColour(red[i], green[i], blue[i]);
+}
+
+TARGET_AVX2 static void packColoursAVX2(const float* red, const float* green, const float* blue, uint32_t* out, int count)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 scale = _mm256_set1_ps(255.0f);
+	const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i r = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(&red[i]), zero), one), scale));
+		__m256i g = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(&green[i]), zero), one), scale));
+		__m256i b = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(&blue[i]), zero), one), scale));
+
+		__m256i pixels = _mm256_or_si256(_mm256_or_si256(r, _mm256_slli_epi32(g, 8)),
+			_mm256_or_si256(_mm256_slli_epi32(b, 16), alpha));
+
+		_mm256_storeu_si256((__m256i*)&out[i], pixels);
+	}
+
+	for (; i < count; ++i)
+		out[i] = packColour(red[i], green[i], blue[i]);
+}
+
+void packColours(const float* red, const float* green, const float* blue, uint32_t* out, int count)
+{
+	if (use_avx2)
+		packColoursAVX2(red, green, blue, out, count);
+	else
+		packColoursSSE2(red, green, blue, out, count);
+}
+
+static void addLightColourSSE2(const float* falloff, float r, float g, float b, float* red, float* green, float* blue, int count)
+{
+	const __m128 colour_r = _mm_set1_ps(r);
+	const __m128 colour_g = _mm_set1_ps(g);
+	const __m128 colour_b = _mm_set1_ps(b);
+
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 f = _mm_loadu_ps(&falloff[i]);
+
+		_mm_storeu_ps(&red[i], _mm_add_ps(_mm_loadu_ps(&red[i]), _mm_mul_ps(f, colour_r)));
+		_mm_storeu_ps(&green[i], _mm_add_ps(_mm_loadu_ps(&green[i]), _mm_mul_ps(f, colour_g)));
+		_mm_storeu_ps(&blue[i], _mm_add_ps(_mm_loadu_ps(&blue[i]), _mm_mul_ps(f, colour_b)));
+	}
+
+	for (; i < count; ++i)
+	{
+		red[i] += falloff[i] * r;
+		green[i] += falloff[i] * g;
+		blue[i] += falloff[i] * b;
+	}
+}
+
+// No fused multiply-add, which would round once and give different sums
+TARGET_AVX2 static void addLightColourAVX2(const float* falloff, float r, float g, float b, float* red, float* green, float* blue, int count)
+{
+	const __m256 colour_r = _mm256_set1_ps(r);
+	const __m256 colour_g = _mm256_set1_ps(g);
+	const __m256 colour_b = _mm256_set1_ps(b);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 f = _mm256_loadu_ps(&falloff[i]);
+
+		_mm256_storeu_ps(&red[i], _mm256_add_ps(_mm256_loadu_ps(&red[i]), _mm256_mul_ps(f, colour_r)));
+		_mm256_storeu_ps(&green[i], _mm256_add_ps(_mm256_loadu_ps(&green[i]), _mm256_mul_ps(f, colour_g)));
+		_mm256_storeu_ps(&blue[i], _mm256_add_ps(_mm256_loadu_ps(&blue[i]), _mm256_mul_ps(f, colour_b)));
+	}
+
+	for (; i < count; ++i)
+	{
+		red[i] += falloff[i] * r;
+		green[i] += falloff[i] * g;
+		blue[i] += falloff[i] * b;
+	}
+}
+
+void addLightColour(const float* falloff, float r, float g, float b, float* red, float* green, float* blue, int count)
+{
+	if (use_avx2)
+		addLightColourAVX2(falloff, r, g, b, red, green, blue, count);
+	else
+		addLightColourSSE2(falloff, r, g, b, red, green, blue, count);
+}
+
+static inline uint16_t addSaturated(uint16_t a, uint16_t b)
+{
+	const int sum = a + b;
+
+	return (uint16_t)(sum > 0xffff ? 0xffff : sum);
+}
+
+static inline uint16_t multiplyFixed(uint16_t a, uint16_t b)
+{
+	return (uint16_t)(((uint32_t)a * b) >> 16);
+}
+
+static inline uint32_t packFixedColour(uint16_t red, uint16_t green, uint16_t blue)
+{
+	return (red >> 8) | (green & 0xff00) | ((uint32_t)(blue >> 8) << 16) | 0xff000000;
+}
+
+static void addLightColourFixedSSE2(const uint16_t* falloff, uint16_t r, uint16_t g, uint16_t b,
+	uint16_t* red, uint16_t* green, uint16_t* blue, int count)
+{
+	const __m128i colour_r = _mm_set1_epi16((short)r);
+	const __m128i colour_g = _mm_set1_epi16((short)g);
+	const __m128i colour_b = _mm_set1_epi16((short)b);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i f = _mm_loadu_si128((const __m128i*)&falloff[i]);
+
+		_mm_storeu_si128((__m128i*)&red[i], _mm_adds_epu16(_mm_loadu_si128((const __m128i*)&red[i]), _mm_mulhi_epu16(f, colour_r)));
+		_mm_storeu_si128((__m128i*)&green[i], _mm_adds_epu16(_mm_loadu_si128((const __m128i*)&green[i]), _mm_mulhi_epu16(f, colour_g)));
+		_mm_storeu_si128((__m128i*)&blue[i], _mm_adds_epu16(_mm_loadu_si128((const __m128i*)&blue[i]), _mm_mulhi_epu16(f, colour_b)));
+	}
+
+	for (; i < count; ++i)
+	{
+		red[i] = addSaturated(red[i], multiplyFixed(falloff[i], r));
+		green[i] = addSaturated(green[i], multiplyFixed(falloff[i], g));
+		blue[i] = addSaturated(blue[i], multiplyFixed(falloff[i], b));
+	}
+}
+
+// A whole region row of sixteen channels per instruction
+TARGET_AVX2 static void addLightColourFixedAVX2(const uint16_t* falloff, uint16_t r, uint16_t g, uint16_t b,
+	uint16_t* red, uint16_t* green, uint16_t* blue, int count)
+{
+	const __m256i colour_r = _mm256_set1_epi16((short)r);
+	const __m256i colour_g = _mm256_set1_epi16((short)g);
+	const __m256i colour_b = _mm256_set1_epi16((short)b);
+
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i f = _mm256_loadu_si256((const __m256i*)&falloff[i]);
+
+		_mm256_storeu_si256((__m256i*)&red[i], _mm256_adds_epu16(_mm256_loadu_si256((const __m256i*)&red[i]), _mm256_mulhi_epu16(f, colour_r)));
+		_mm256_storeu_si256((__m256i*)&green[i], _mm256_adds_epu16(_mm256_loadu_si256((const __m256i*)&green[i]), _mm256_mulhi_epu16(f, colour_g)));
+		_mm256_storeu_si256((__m256i*)&blue[i], _mm256_adds_epu16(_mm256_loadu_si256((const __m256i*)&blue[i]), _mm256_mulhi_epu16(f, colour_b)));
+	}
+
+	for (; i < count; ++i)
+	{
+		red[i] = addSaturated(red[i], multiplyFixed(falloff[i], r));
+		green[i] = addSaturated(green[i], multiplyFixed(falloff[i], g));
+		blue[i] = addSaturated(blue[i], multiplyFixed(falloff[i], b));
+	}
+}
+
+void addLightColourFixed(const uint16_t* falloff, uint16_t r, uint16_t g, uint16_t b,
+	uint16_t* red, uint16_t* green, uint16_t* blue, int count)
+{
+	if (use_avx2)
+		addLightColourFixedAVX2(falloff, r, g, b, red, green, blue, count);
+	else
+		addLightColourFixedSSE2(falloff, r, g, b, red, green, blue, count);
+}
+
+// Red and green end up in the low and high bytes of one 16-bit word, blue and
+// the alpha in another, and interleaving the two gives the pixels
+static void packColoursFixedSSE2(const uint16_t* red, const uint16_t* green, const uint16_t* blue, uint32_t* out, int count)
+{
+	const __m128i high_byte = _mm_set1_epi16((short)0xff00);
+	const __m128i alpha = _mm_set1_epi16((short)0xff00);
+
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i rg = _mm_or_si128(_mm_srli_epi16(_mm_loadu_si128((const __m128i*)&red[i]), 8),
+			_mm_and_si128(_mm_loadu_si128((const __m128i*)&green[i]), high_byte));
+		__m128i ba = _mm_or_si128(_mm_srli_epi16(_mm_loadu_si128((const __m128i*)&blue[i]), 8), alpha);
+
+		_mm_storeu_si128((__m128i*)&out[i], _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i*)&out[i + 4], _mm_unpackhi_epi16(rg, ba));
+	}
+
+	for (; i < count; ++i)
+		out[i] = packFixedColour(red[i], green[i], blue[i]);
+}
+
+TARGET_AVX2 static void packColoursFixedAVX2(const uint16_t* red, const uint16_t* green, const uint16_t* blue, uint32_t* out, int count)
+{
+	const __m256i high_byte = _mm256_set1_epi16((short)0xff00);
+	const __m256i alpha = _mm256_set1_epi16((short)0xff00);
+
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i rg = _mm256_or_si256(_mm256_srli_epi16(_mm256_loadu_si256((const __m256i*)&red[i]), 8),
+			_mm256_and_si256(_mm256_loadu_si256((const __m256i*)&green[i]), high_byte));
+		__m256i ba = _mm256_or_si256(_mm256_srli_epi16(_mm256_loadu_si256((const __m256i*)&blue[i]), 8), alpha);
+
+		// Unpacking works within each 128-bit half, so put pixels 0-7 in the low
+		// quarters of the halves and 8-15 in the high ones first
+		rg = _mm256_permute4x64_epi64(rg, 0xd8);
+		ba = _mm256_permute4x64_epi64(ba, 0xd8);
+
+		_mm256_storeu_si256((__m256i*)&out[i], _mm256_unpacklo_epi16(rg, ba));
+		_mm256_storeu_si256((__m256i*)&out[i + 8], _mm256_unpackhi_epi16(rg, ba));
+	}
+
+	for (; i < count; ++i)
+		out[i] = packFixedColour(red[i], green[i], blue[i]);
+}
+
+void packColoursFixed(const uint16_t* red, const uint16_t* green, const uint16_t* blue, uint32_t* out, int count)
+{
+	if (use_avx2)
+		packColoursFixedAVX2(red, green, blue, out, count);
+	else
+		packColoursFixedSSE2(red, green, blue, out, count);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+// Clamps a run of tile colours, given as separate red, green and blue planes,
+// to [0, 1], scales them to 0-255 and packs them into ABGR8888 pixels with an
+// opaque alpha, giving exactly the pixels the colour_t conversion does
+// Uses AVX2 when available, SSE2 otherwise
+void packColours(const float* red, const float* green, const float* blue, uint32_t* out, int count);
+
+// Adds a light's colour scaled by its falloff at each tile to the red, green
+// and blue planes, red[i] += falloff[i] * r and so on, rounding the multiply
+// and the add separately so the sums match the scalar code exactly
+// Uses AVX2 when available, SSE2 otherwise
+void addLightColour(const float* falloff, float r, float g, float b, float* red, float* green, float* blue, int count);
+
+// The integer lighting path keeps colour channels as 8.8 fixed point, the whole
+// part being the 8-bit colour so 0xff00 is full brightness, and attenuation as
+// 0.16 fixed point with 0xffff for full strength
+inline uint16_t toFixedChannel(float value)
+{
+	const float fixed = value * 65280.0f + 0.5f;
+
+	return (uint16_t)(fixed < 0.0f ? 0.0f : (fixed > 65535.0f ? 65535.0f : fixed));
+}
+
+inline uint16_t toFixedAttenuation(float att)
+{
+	const float fixed = att * 65535.0f + 0.5f;
+
+	return (uint16_t)(fixed < 0.0f ? 0.0f : (fixed > 65535.0f ? 65535.0f : fixed));
+}
+
+// As addLightColour() in fixed point, red[i] saturates at 0xffff after adding
+// the top 16 bits of falloff[i] * r, so the sums are the same in any order
+// Uses AVX2 when available, SSE2 otherwise
+void addLightColourFixed(const uint16_t* falloff, uint16_t r, uint16_t g, uint16_t b,
+	uint16_t* red, uint16_t* green, uint16_t* blue, int count);
+
+// As packColours() for fixed point channels, which only takes the whole part of each
+void packColoursFixed(const uint16_t* red, const uint16_t* green, const uint16_t* blue, uint32_t* out, int count);
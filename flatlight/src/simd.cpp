@@ -0,0 +1,62 @@
+#include "simd.h"
+
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+bool use_avx2 = cpuHasAVX2();
+
+// Reads the enabled state components from XCR0
+static uint64_t readXCR0()
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+// Runs cpuid for a leaf and subleaf, filling in eax, ebx, ecx, edx
+static void cpuid(int leaf, int subleaf, uint32_t regs[4])
+{
+#if defined(_MSC_VER)
+	__cpuidex((int*)regs, leaf, subleaf);
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+bool cpuHasAVX2()
+{
+	uint32_t regs[4];
+
+	cpuid(0, 0, regs);
+
+	if (regs[0] < 7)
+		return false;
+
+	// The OS has to save the ymm registers (OSXSAVE, then XCR0 SSE and AVX state)
+	cpuid(1, 0, regs);
+
+	const uint32_t OSXSAVE = 1 << 27;
+	const uint32_t AVX = 1 << 28;
+
+	if ((regs[2] & (OSXSAVE | AVX)) != (OSXSAVE | AVX))
+		return false;
+
+	if ((readXCR0() & 0x6) != 0x6)
+		return false;
+
+	cpuid(7, 0, regs);
+
+	const uint32_t AVX2 = 1 << 5;
+
+	return (regs[1] & AVX2) != 0;
+}
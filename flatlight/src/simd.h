@@ -0,0 +1,14 @@
+#pragma once
+
+// Marks a function as using AVX2 instructions, MSVC allows intrinsics anywhere
+#if defined(_MSC_VER)
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Set at startup if the CPU and OS support AVX2, clear it to force the scalar paths
+extern bool use_avx2;
+
+// Returns true if AVX2 instructions can be used on this machine
+bool cpuHasAVX2();
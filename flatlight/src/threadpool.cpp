@@ -0,0 +1,265 @@
+#include "threadpool.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <SDL2/SDL.h>
+
+struct worker_t
+{
+	// Indices still to run, begin in the low 32 bits and end in the high 32 bits
+	// The owner takes from the front and thieves take from the back
+	std::atomic<uint64_t> range;
+
+	worker_stats_t stats;
+	std::thread thread;
+};
+
+// Workers, the last is the thread calling parallelFor()
+static std::vector<worker_t*> workers;
+
+// Hands jobs out to the worker threads and waits for them to finish
+static std::mutex pool_mutex;
+static std::condition_variable start_condition;
+static std::condition_variable done_condition;
+
+static const std::function<void(int)>* current_job = nullptr;
+static int generation = 0;
+static int workers_running = 0;
+static bool stopping = false;
+
+static uint64_t packRange(uint32_t begin, uint32_t end)
+{
+	return ((uint64_t)end << 32) | begin;
+}
+
+// Takes the next index from the front of a worker's own range
+static bool popJob(worker_t& worker, int* index)
+{
+	uint64_t range = worker.range.load();
+
+	while (true)
+	{
+		uint32_t begin = (uint32_t)range;
+		uint32_t end = (uint32_t)(range >> 32);
+
+		if (begin >= end)
+			return false;
+
+		if (worker.range.compare_exchange_weak(range, packRange(begin + 1, end)))
+		{
+			*index = begin;
+			return true;
+		}
+	}
+}
+
+// Moves the back half of another worker's range into this worker's range
+static bool stealJobs(int thief_index)
+{
+	const int worker_count = (int)workers.size();
+
+	for (int i = 1; i < worker_count; ++i)
+	{
+		worker_t& victim = *workers[(thief_index + i) % worker_count];
+
+		uint64_t range = victim.range.load();
+
+		while (true)
+		{
+			uint32_t begin = (uint32_t)range;
+			uint32_t end = (uint32_t)(range >> 32);
+
+			if (begin >= end)
+				break;
+
+			uint32_t mid = begin + (end - begin) / 2;
+
+			if (victim.range.compare_exchange_weak(range, packRange(begin, mid)))
+			{
+				workers[thief_index]->range.store(packRange(mid, end));
+				workers[thief_index]->stats.steals++;
+
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+// Runs jobs until there are none left in any worker's range
+static void runJobs(int worker_index)
+{
+	worker_t& worker = *workers[worker_index];
+
+	Uint64 start = SDL_GetPerformanceCounter();
+
+	while (true)
+	{
+		int index;
+
+		if (popJob(worker, &index))
+		{
+			(*current_job)(index);
+			worker.stats.jobs++;
+		}
+		else if (!stealJobs(worker_index))
+		{
+			break;
+		}
+	}
+
+	worker.stats.busy_seconds += (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+}
+
+static void workerMain(int worker_index)
+{
+	int last_generation = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(pool_mutex);
+
+			start_condition.wait(lock, [&] { return stopping || generation != last_generation; });
+
+			if (stopping)
+				return;
+
+			last_generation = generation;
+		}
+
+		runJobs(worker_index);
+
+		{
+			std::lock_guard<std::mutex> lock(pool_mutex);
+
+			if (--workers_running == 0)
+				done_condition.notify_one();
+		}
+	}
+}
+
+void startThreadPool(int thread_count)
+{
+	stopThreadPool();
+
+	if (thread_count < 1)
+		thread_count = 1;
+
+	// Every worker has been joined, and the new ones wait for the generation after 0
+	stopping = false;
+	generation = 0;
+	workers_running = 0;
+
+	for (int i = 0; i < thread_count; ++i)
+	{
+		worker_t* worker = new worker_t;
+		worker->range.store(0);
+		worker->stats = worker_stats_t{ 0, 0, 0.0 };
+
+		workers.push_back(worker);
+	}
+
+	// The calling thread is the last worker, so it gets no thread
+	for (int i = 0; i < thread_count - 1; ++i)
+		workers[i]->thread = std::thread(workerMain, i);
+}
+
+void stopThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(pool_mutex);
+		stopping = true;
+	}
+
+	start_condition.notify_all();
+
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		if (workers[i]->thread.joinable())
+			workers[i]->thread.join();
+
+		delete workers[i];
+	}
+
+	workers.clear();
+}
+
+int getThreadCount()
+{
+	return (int)workers.size();
+}
+
+void parallelFor(int count, const std::function<void(int)>& job)
+{
+	if (workers.empty())
+		startThreadPool(1);
+
+	const int worker_count = (int)workers.size();
+
+	// Give each worker an even share to start with
+	for (int i = 0; i < worker_count; ++i)
+	{
+		uint32_t begin = (uint32_t)((int64_t)count * i / worker_count);
+		uint32_t end = (uint32_t)((int64_t)count * (i + 1) / worker_count);
+
+		workers[i]->range.store(packRange(begin, end));
+	}
+
+	current_job = &job;
+
+	if (worker_count > 1)
+	{
+		{
+			std::lock_guard<std::mutex> lock(pool_mutex);
+
+			workers_running = worker_count - 1;
+			generation++;
+		}
+
+		start_condition.notify_all();
+	}
+
+	runJobs(worker_count - 1);
+
+	if (worker_count > 1)
+	{
+		std::unique_lock<std::mutex> lock(pool_mutex);
+
+		done_condition.wait(lock, [] { return workers_running == 0; });
+	}
+
+	current_job = nullptr;
+}
+
+const worker_stats_t& getWorkerStats(int worker)
+{
+	return workers[worker]->stats;
+}
+
+void resetWorkerStats()
+{
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i]->stats = worker_stats_t{ 0, 0, 0.0 };
+}
+
+void printWorkerStats(int frames)
+{
+	if (frames < 1)
+		frames = 1;
+
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		const worker_stats_t& stats = workers[i]->stats;
+
+		printf("Worker %d: %.1f jobs, %.1f steals, %.3f ms busy per frame\n", (int)i,
+			(float)stats.jobs / frames, (float)stats.steals / frames, stats.busy_seconds * 1000.0 / frames);
+	}
+}
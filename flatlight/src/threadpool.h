@@ -0,0 +1,29 @@
+#pragma once
+
+#include <functional>
+
+// Time and work done by one worker since the stats were last reset
+struct worker_stats_t
+{
+	int jobs;
+	int steals;
+	double busy_seconds;
+};
+
+// Starts a pool of persistent worker threads, the thread calling parallelFor()
+// takes part as the last worker so thread_count - 1 threads are created
+void startThreadPool(int thread_count);
+void stopThreadPool();
+
+int getThreadCount();
+
+// Runs job(index) for every index in [0, count) across the workers and waits for them all
+// Each worker starts with an even share of the indices, and steals half of
+// another worker's remaining share when its own runs out
+void parallelFor(int count, const std::function<void(int)>& job);
+
+const worker_stats_t& getWorkerStats(int worker);
+void resetWorkerStats();
+
+// Prints each worker's stats, averaged over the given number of frames
+void printWorkerStats(int frames);
@@ -0,0 +1,981 @@
+#include "visibility.h"
+
+#include "level.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+// A segment end as seen from a light, where the segment enters or leaves the sweep
+struct sweep_event_t
+{
+	float angle;
+	int segment;
+	bool begin;
+};
+
+// How the rays from a light to a block of tiles turn out
+enum shaft_t
+{
+	SHAFT_MIXED,		// Some tiles may be lit and some not, so each is cast
+	SHAFT_CLEAR,		// Nothing in the way, every open tile is lit
+	SHAFT_BLOCKED		// A wall across the way, no tile is lit
+};
+
+// A polygon edge crossing the centre line of a row of tiles
+struct row_crossing_t
+{
+	int y;
+	float x;
+};
+
+// A slope of col / depth within an octant, kept as an exact fraction
+// so that shadow edges through tile corners compare without rounding
+struct slope_t
+{
+	int num;
+	int den;
+};
+
+// A row of an octant that still has to be scanned, and the unblocked slopes through it
+struct row_t
+{
+	int depth;
+	slope_t start;
+	slope_t end;
+};
+
+static const char* visibility_mode_names[VISIBILITY_MODE_COUNT] =
+{
+	"raycast",
+	"shadowcast",
+	"polar",
+	"polygon",
+	"volume",
+	"distance"
+};
+
+int polar_bins = 2048;
+
+// Side of the square blocks of tiles that raycastVisibility() tests against a light together
+const int SHAFT_BLOCK_SIZE = 8;
+
+// Tiles away from the line between the light and a tile that a ray to it can visit
+const int SHAFT_MARGIN = 2;
+
+// Rows whose shaft spans are merged when checking for a clear shaft
+const int SHAFT_BAND_ROWS = 8;
+
+const float PI = 3.14159265f;
+const float HALF_PI = 1.57079633f;
+
+const char* getVisibilityModeName(visibility_mode_t mode)
+{
+	return visibility_mode_names[mode];
+}
+
+bool parseVisibilityMode(const char* name, visibility_mode_t* mode)
+{
+	for (int i = 0; i < VISIBILITY_MODE_COUNT; ++i)
+	{
+		if (strcmp(name, visibility_mode_names[i]) == 0)
+		{
+			*mode = (visibility_mode_t)i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool isVisibilityPerTile(visibility_mode_t mode)
+{
+	return (mode == VISIBILITY_RAYCAST || mode == VISIBILITY_DISTANCE_FIELD);
+}
+
+void computeVisibility(visibility_mode_t mode, int lightx, int lighty, uint8_t* visible)
+{
+	computeVisibilityWindow(mode, lightx, lighty, visible, getLevelRect());
+}
+
+void computeVisibilityWindow(visibility_mode_t mode, int lightx, int lighty, uint8_t* visible, const tile_rect_t& window)
+{
+	computeVisibilityRect(mode, lightx, lighty, visible, window, window);
+}
+
+void computeVisibilityRect(visibility_mode_t mode, int lightx, int lighty, uint8_t* visible,
+	const tile_rect_t& window, const tile_rect_t& rect)
+{
+	switch (mode)
+	{
+	case VISIBILITY_SHADOWCAST:
+		shadowcastVisibility(lightx, lighty, visible, window);
+		break;
+	case VISIBILITY_POLAR:
+		polarVisibility(lightx, lighty, visible, window);
+		break;
+	case VISIBILITY_POLYGON:
+		polygonVisibility(lightx, lighty, visible, window);
+		break;
+	case VISIBILITY_SHADOW_VOLUME:
+		shadowVolumeVisibility(lightx, lighty, visible, window);
+		break;
+	case VISIBILITY_DISTANCE_FIELD:
+		distanceFieldVisibility(lightx, lighty, visible, window, rect);
+		break;
+	default:
+		raycastVisibility(lightx, lighty, visible, window, rect);
+		break;
+	}
+}
+
+// Casts from a light to a batch of up to eight tiles and marks the ones it reaches
+static void raycastBatch(int lightx, int lighty, int* endx, int* endy, int count, uint8_t* visible, const tile_rect_t& window)
+{
+	// Spare lanes cast to the light itself, which never hits
+	for (int i = count; i < 8; ++i)
+	{
+		endx[i] = lightx;
+		endy[i] = lighty;
+	}
+
+	uint8_t hits = raycast8(lightx, lighty, endx, endy);
+
+	const int window_width = window.x_end - window.x_begin;
+
+	for (int i = 0; i < count; ++i)
+		visible[(endy[i] - window.y_begin) * window_width + endx[i] - window.x_begin] = !(hits & (1 << i));
+}
+
+// Rays from a light to the corners of a block, along which the rays to every
+// tile of the block lie
+struct shaft_corners_t
+{
+	float light[2];
+	float corner[4][2];
+	float slope[2][4];
+};
+
+static shaft_corners_t getShaftCorners(int lightx, int lighty, const tile_rect_t& block)
+{
+	shaft_corners_t shaft;
+
+	shaft.light[0] = (float)lightx;
+	shaft.light[1] = (float)lighty;
+
+	for (int i = 0; i < 4; ++i)
+	{
+		shaft.corner[i][0] = (float)((i & 1) ? block.x_end - 1 : block.x_begin);
+		shaft.corner[i][1] = (float)((i & 2) ? block.y_end - 1 : block.y_begin);
+
+		// Change along each axis per step along the other
+		for (int axis = 0; axis < 2; ++axis)
+		{
+			const float along = shaft.corner[i][1 - axis] - shaft.light[1 - axis];
+
+			shaft.slope[axis][i] = (along != 0.0f ? (shaft.corner[i][axis] - shaft.light[axis]) / along : 0.0f);
+		}
+	}
+
+	return shaft;
+}
+
+// Finds a range along one axis that covers every ray of the shaft where the
+// other axis is between lo and hi
+// Each corner ray is taken at lo and hi clamped to its own length, which at
+// worst widens the range with points outside the slab, but always takes in
+// the rays to the tiles between the corners and the block itself
+static void getShaftSpan(const shaft_corners_t& shaft, int axis, float lo, float hi, float* span_min, float* span_max)
+{
+	const int other = 1 - axis;
+
+	*span_min = FLT_MAX;
+	*span_max = -FLT_MAX;
+
+	for (int i = 0; i < 4; ++i)
+	{
+		const float first = glm::min(shaft.light[other], shaft.corner[i][other]);
+		const float last = glm::max(shaft.light[other], shaft.corner[i][other]);
+
+		for (int end = 0; end < 2; ++end)
+		{
+			const float along = glm::clamp(end == 0 ? lo : hi, first, last);
+
+			const float at = (first == last ? shaft.corner[i][axis]
+				: shaft.light[axis] + (along - shaft.light[other]) * shaft.slope[axis][i]);
+
+			*span_min = glm::min(*span_min, at);
+			*span_max = glm::max(*span_max, at);
+		}
+	}
+}
+
+// Sorts a block of tiles into ones that raycast() from the light reaches in
+// full, in none, or in part
+// Every tile a ray visits is within two tiles of the line from the light to
+// its end, counting the step past the end it can take, so a ray can only
+// visit tiles within two of the hull of the light and the block: if they
+// are all open every ray is clear
+// A ray visits every row between its start and end, except maybe the one
+// before the end if it stops short, so a row between the light and the
+// block that is all walls across the hull is crossed and blocks every ray,
+// and the same for a column
+static shaft_t testShaft(int lightx, int lighty, const tile_rect_t& block)
+{
+	const shaft_corners_t shaft = getShaftCorners(lightx, lighty, block);
+
+	float span_min;
+	float span_max;
+
+	bool clear = true;
+
+	const int first_clear_row = glm::min(lighty, block.y_begin) - SHAFT_MARGIN;
+	const int last_clear_row = glm::max(lighty, block.y_end - 1) + SHAFT_MARGIN;
+
+	// Rows are checked in bands sharing one span, wider than each row needs
+	// but far cheaper to work out
+	for (int band = first_clear_row; band <= last_clear_row && clear; band += SHAFT_BAND_ROWS)
+	{
+		const int band_end = glm::min(band + SHAFT_BAND_ROWS - 1, last_clear_row);
+
+		getShaftSpan(shaft, 0, (float)(band - SHAFT_MARGIN), (float)(band_end + SHAFT_MARGIN), &span_min, &span_max);
+
+		const int x_first = (int)floor(span_min) - SHAFT_MARGIN;
+		const int x_last = (int)ceil(span_max) + SHAFT_MARGIN;
+
+		for (int y = band; y <= band_end && clear; ++y)
+			clear = isRowOpen(y, x_first, x_last);
+	}
+
+	if (clear)
+		return SHAFT_CLEAR;
+
+	// Rows and columns every ray crosses, between the light and the block with a gap of one before the block
+	const int first_row = (block.y_begin > lighty ? lighty + 1 : block.y_end + 1);
+	const int last_row = (block.y_begin > lighty ? block.y_begin - 2 : lighty - 1);
+
+	// A row or column can only be all walls if the tile the first corner ray
+	// crosses it at is, which rules most out before working out their span
+	for (int y = first_row; y <= last_row; ++y)
+	{
+		if (!isWall((int)floor(shaft.light[0] + (y - shaft.light[1]) * shaft.slope[0][0]), y))
+			continue;
+
+		getShaftSpan(shaft, 0, (float)(y - SHAFT_MARGIN), (float)(y + SHAFT_MARGIN), &span_min, &span_max);
+
+		if (isRowWall(y, (int)floor(span_min) - SHAFT_MARGIN, (int)ceil(span_max) + SHAFT_MARGIN))
+			return SHAFT_BLOCKED;
+	}
+
+	const int first_column = (block.x_begin > lightx ? lightx + 1 : block.x_end + 1);
+	const int last_column = (block.x_begin > lightx ? block.x_begin - 2 : lightx - 1);
+
+	for (int x = first_column; x <= last_column; ++x)
+	{
+		if (!isWall(x, (int)floor(shaft.light[1] + (x - shaft.light[0]) * shaft.slope[1][0])))
+			continue;
+
+		getShaftSpan(shaft, 1, (float)(x - SHAFT_MARGIN), (float)(x + SHAFT_MARGIN), &span_min, &span_max);
+
+		if (isColumnWall(x, (int)floor(span_min) - SHAFT_MARGIN, (int)ceil(span_max) + SHAFT_MARGIN))
+			return SHAFT_BLOCKED;
+	}
+
+	return SHAFT_MIXED;
+}
+
+void raycastVisibility(int lightx, int lighty, uint8_t* visible, const tile_rect_t& window, const tile_rect_t& rect)
+{
+	const tile_rect_t tiles = intersectRects(intersectRects(window, rect), getLevelRect());
+	const int window_width = window.x_end - window.x_begin;
+
+	if (isRectEmpty(tiles))
+		return;
+
+	for (int y = tiles.y_begin; y < tiles.y_end; ++y)
+		memset(&visible[(y - window.y_begin) * window_width + tiles.x_begin - window.x_begin], 0, tiles.x_end - tiles.x_begin);
+
+	// Air tiles along a row are cast to eight at a time, they share the
+	// light as a start and take nearly the same path so they step together
+	int endx[8];
+	int endy[8];
+
+	// Blocks are resolved whole when their shaft is clear or blocked
+	for (int block_y = tiles.y_begin; block_y < tiles.y_end; block_y += SHAFT_BLOCK_SIZE)
+	{
+		for (int block_x = tiles.x_begin; block_x < tiles.x_end; block_x += SHAFT_BLOCK_SIZE)
+		{
+			const tile_rect_t block = intersectRects(tiles,
+				tile_rect_t{ block_x, block_y, block_x + SHAFT_BLOCK_SIZE, block_y + SHAFT_BLOCK_SIZE });
+
+			const shaft_t shaft = testShaft(lightx, lighty, block);
+
+			if (shaft == SHAFT_BLOCKED)
+				continue;
+
+			for (int y = block.y_begin; y < block.y_end; ++y)
+			{
+				uint8_t* row = &visible[(y - window.y_begin) * window_width - window.x_begin];
+
+				int count = 0;
+
+				for (int x = block.x_begin; x < block.x_end; ++x)
+				{
+					if (getTile(x, y) == '#')
+						continue;
+
+					if (shaft == SHAFT_CLEAR)
+					{
+						row[x] = 1;
+						continue;
+					}
+
+					endx[count] = x;
+					endy[count] = y;
+
+					if (++count == 8)
+					{
+						raycastBatch(lightx, lighty, endx, endy, count, visible, window);
+						count = 0;
+					}
+				}
+
+				if (count > 0)
+					raycastBatch(lightx, lighty, endx, endy, count, visible, window);
+			}
+		}
+	}
+}
+
+void distanceFieldVisibility(int lightx, int lighty, uint8_t* visible, const tile_rect_t& window, const tile_rect_t& rect)
+{
+	const tile_rect_t tiles = intersectRects(intersectRects(window, rect), getLevelRect());
+	const int window_width = window.x_end - window.x_begin;
+
+	for (int y = tiles.y_begin; y < tiles.y_end; ++y)
+	{
+		uint8_t* row = &visible[(y - window.y_begin) * window_width - window.x_begin];
+
+		for (int x = tiles.x_begin; x < tiles.x_end; ++x)
+			row[x] = (getTile(x, y) != '#' && !raycastDistanceField(lightx, lighty, x, y));
+	}
+}
+
+// Returns true if a < b
+static bool slopeLess(slope_t a, slope_t b)
+{
+	return (int64_t)a.num * b.den < (int64_t)b.num * a.den;
+}
+
+static bool slopeEqual(slope_t a, slope_t b)
+{
+	return (int64_t)a.num * b.den == (int64_t)b.num * a.den;
+}
+
+// Rounds num / den towards negative and positive infinity, den is always positive
+static int floorDiv(int num, int den)
+{
+	return (num >= 0 ? num / den : -((-num + den - 1) / den));
+}
+
+static int ceilDiv(int num, int den)
+{
+	return -floorDiv(-num, den);
+}
+
+// One of the eight octants around a light
+// Tiles are addressed by depth (distance along the major axis) and column,
+// and slopes are column / depth with both counted away from the light
+struct octant_t
+{
+	int xdir;
+	int ydir;
+	bool steep;
+};
+
+static const octant_t octants[8] =
+{
+	{ 1, 1, false }, { 1, 1, true },
+	{ -1, 1, false }, { -1, 1, true },
+	{ 1, -1, false }, { 1, -1, true },
+	{ -1, -1, false }, { -1, -1, true }
+};
+
+// Converts a depth and column in an octant to a tile position
+static void octantToTile(const octant_t& octant, int originx, int originy, int depth, int col, int* x, int* y)
+{
+	if (octant.steep)
+	{
+		*x = originx + col * octant.xdir;
+		*y = originy + depth * octant.ydir;
+	}
+	else
+	{
+		*x = originx + depth * octant.xdir;
+		*y = originy + col * octant.ydir;
+	}
+}
+
+// Recursive shadowcasting, based on Albert Ford's symmetric shadowcasting (2017)
+// Each octant is scanned row by row outward from the light, narrowing the
+// range of open slopes as walls are found and splitting it around them,
+// so every tile is visited about once.
+// To give the same answers as raycast() it uses the same ray geometry: in each
+// quadrant rays run from the light tile's corner facing away from the target to
+// the matching corner of the target, a ray through a tile corner steps along y
+// first, and rays along an axis stay on the light's row or column.
+// In the shallow octants that makes a wall block the slopes [lo, hi), and
+// in the steep octants (lo, hi], so slopes are compared exactly as fractions.
+// That geometry isn't symmetric the way Ford's is, but it keeps the lit tiles
+// identical to the raycast path.
+void shadowcastVisibility(int lightx, int lighty, uint8_t* visible, const tile_rect_t& window)
+{
+	const int window_width = window.x_end - window.x_begin;
+
+	memset(visible, 0, window_width * (window.y_end - window.y_begin));
+
+	// Nothing is lit from inside a wall
+	if (isWall(lightx, lighty))
+		return;
+
+	// Only tiles in both the level and the window are scanned
+	const tile_rect_t tiles = intersectRects(window, getLevelRect());
+
+	if (isInRect(tiles, lightx, lighty))
+		visible[(lighty - window.y_begin) * window_width + lightx - window.x_begin] = 1;
+
+	std::vector<row_t> rows;
+
+	for (int i = 0; i < 8; ++i)
+	{
+		const octant_t& octant = octants[i];
+
+		// Furthest row inside the level and the window
+		int max_depth;
+
+		if (octant.steep)
+			max_depth = (octant.ydir > 0 ? tiles.y_end - 1 - lighty : lighty - tiles.y_begin);
+		else
+			max_depth = (octant.xdir > 0 ? tiles.x_end - 1 - lightx : lightx - tiles.x_begin);
+
+		// Rays along an axis belong to the positive side of the other axis,
+		// and the diagonal belongs to the shallow octant
+		const int first_col = ((octant.steep ? octant.xdir : octant.ydir) < 0 ? 1 : 0);
+
+		if (octant.steep)
+			rows.push_back(row_t{ 1, slope_t{ -1, 1 }, slope_t{ 1, 1 } });
+		else
+			rows.push_back(row_t{ 0, slope_t{ 0, 1 }, slope_t{ 2, 1 } });
+
+		while (!rows.empty())
+		{
+			row_t row = rows.back();
+			rows.pop_back();
+
+			if (row.depth > max_depth)
+				continue;
+
+			const int depth = row.depth;
+
+			// The steep octants end before the diagonal, but a wall on it
+			// shadows them, as does a wall one past it for the shallow octants
+			const int last_col = (octant.steep ? depth - 1 : depth);
+
+			// Walls just outside the open slopes can still shadow part of them
+			int min_col = floorDiv(depth * row.start.num, row.start.den) - 1;
+			int max_col = ceilDiv(depth * row.end.num, row.end.den) + 1;
+
+			if (min_col < 0)
+				min_col = 0;
+			if (max_col > last_col + 1)
+				max_col = last_col + 1;
+
+			slope_t start = row.start;
+
+			for (int col = min_col; col <= max_col; ++col)
+			{
+				int x, y;
+				octantToTile(octant, lightx, lighty, depth, col, &x, &y);
+
+				if (isWall(x, y))
+				{
+					// Slopes covered by the wall square
+					slope_t lo, hi;
+
+					if (octant.steep)
+					{
+						// Axis rays stay in the light's column, so it shadows them too
+						lo = (col == 0 ? slope_t{ -1, 1 } : slope_t{ col, depth + 1 });
+						hi = slope_t{ col + 1, depth };
+					}
+					else
+					{
+						// A zero denominator is an infinite slope
+						lo = slope_t{ col, depth + 1 };
+						hi = slope_t{ col + 1, depth };
+					}
+
+					// Ignore walls that don't overlap the open slopes
+					if (!slopeLess(lo, row.end) || !slopeLess(start, hi))
+						continue;
+
+					// Scan the open slopes before this wall in the next row, even when
+					// only a single slope between two shadows is left
+					if (!slopeLess(lo, start))
+						rows.push_back(row_t{ depth + 1, start, lo });
+
+					start = hi;
+				}
+				else
+				{
+					if (depth == 0 || col < first_col || col > last_col || !isInRect(tiles, x, y))
+						continue;
+
+					// Lit if the slope to the tile is open, boundaries are included
+					// on the side a ray through a corner leans towards
+					slope_t slope{ col, depth };
+					bool lit;
+
+					if (octant.steep)
+						lit = (slopeLess(row.start, slope) && !slopeLess(row.end, slope));
+					else
+						lit = (!slopeLess(slope, row.start) && slopeLess(slope, row.end));
+
+					// raycast() decides ties between tile edges with rounded floats, and
+					// can step one tile past its target, so on a shadow edge or next to
+					// a wall ask it directly to keep both paths identical
+					bool on_edge = slopeEqual(slope, row.start) || slopeEqual(slope, row.end);
+
+					if (on_edge || isWall(x - 1, y) || isWall(x + 1, y) || isWall(x, y - 1) || isWall(x, y + 1))
+						lit = !raycast(lightx, lighty, x, y);
+
+					if (lit)
+						visible[(y - window.y_begin) * window_width + x - window.x_begin] = 1;
+				}
+			}
+
+			// Carry on with whatever is left open after the last wall
+			if (!slopeLess(row.end, start))
+				rows.push_back(row_t{ depth + 1, start, row.end });
+		}
+	}
+}
+
+// Polar shadow map visibility
+// raycast() runs from corner to corner of the tiles, and which corner depends
+// on the direction, so each quadrant around the light gets its own map with
+// offsets measured away from the light: a target (x, y) in a quadrant is at
+// (|x - lightx|, |y - lighty|) and a wall covers the unit square from
+// (x - lightx, y - lighty) flipped into it, or from the flipped offset minus one
+// where x or y is on the negative side
+void polarVisibility(int lightx, int lighty, uint8_t* visible, const tile_rect_t& window)
+{
+	const int window_width = window.x_end - window.x_begin;
+
+	memset(visible, 0, window_width * (window.y_end - window.y_begin));
+
+	// Nothing is lit from inside a wall
+	if (isWall(lightx, lighty))
+		return;
+
+	// Bins in each quadrant, from angle 0 along the axis to pi / 2
+	const int quadrant_bins = (polar_bins >= 4 ? polar_bins / 4 : 1);
+	const float bin_scale = quadrant_bins / HALF_PI;
+
+	// Squared distance to the nearest wall in each bin of each quadrant,
+	// quadrant bit 0 is set for negative x and bit 1 for negative y
+	std::vector<float> depth(4 * quadrant_bins, FLT_MAX);
+
+	// Rays to tiles in the window never leave it, so neither do the walls that block them
+	const tile_rect_t tiles = intersectRects(window, getLevelRect());
+
+	for (int y = tiles.y_begin; y < tiles.y_end; ++y)
+	{
+		for (int x = tiles.x_begin; x < tiles.x_end; ++x)
+		{
+			if (getTile(x, y) != '#')
+				continue;
+
+			for (int quadrant = 0; quadrant < 4; ++quadrant)
+			{
+				int u_begin = ((quadrant & 1) ? lightx - x : x - lightx);
+				int v_begin = ((quadrant & 2) ? lighty - y : y - lighty);
+
+				// Squares behind an axis are never crossed by a ray into the quadrant
+				if (u_begin < 0 || v_begin < 0)
+					continue;
+
+				// The square covers the angles from its far u near v corner to its
+				// near u far v corner, and the nearest point is its near corner
+				float first_angle = atan2((float)v_begin, (float)(u_begin + 1));
+				float last_angle = atan2((float)(v_begin + 1), (float)u_begin);
+
+				float dist = (float)(u_begin * u_begin + v_begin * v_begin);
+
+				// Only bins whose centre angle is inside the range are covered
+				int first = (int)ceil(first_angle * bin_scale - 0.5f);
+				int last = (int)floor(last_angle * bin_scale - 0.5f);
+
+				first = (first < 0 ? 0 : first);
+				last = (last >= quadrant_bins ? quadrant_bins - 1 : last);
+
+				float* bin_depth = &depth[quadrant * quadrant_bins];
+
+				for (int bin = first; bin <= last; ++bin)
+					bin_depth[bin] = (dist < bin_depth[bin] ? dist : bin_depth[bin]);
+			}
+		}
+	}
+
+	// Then each air tile is a lookup and a compare
+	for (int y = tiles.y_begin; y < tiles.y_end; ++y)
+	{
+		for (int x = tiles.x_begin; x < tiles.x_end; ++x)
+		{
+			if (getTile(x, y) == '#')
+				continue;
+
+			int quadrant = (x < lightx ? 1 : 0) | (y < lighty ? 2 : 0);
+
+			float u = (float)abs(x - lightx);
+			float v = (float)abs(y - lighty);
+
+			int bin = (int)(atan2(v, u) * bin_scale);
+			bin = (bin >= quadrant_bins ? quadrant_bins - 1 : bin);
+
+			if (u * u + v * v < depth[quadrant * quadrant_bins + bin])
+				visible[(y - window.y_begin) * window_width + x - window.x_begin] = 1;
+		}
+	}
+}
+
+static bool compareSweepEvents(const sweep_event_t& a, const sweep_event_t& b)
+{
+	return (a.angle < b.angle);
+}
+
+static bool compareRowCrossings(const row_crossing_t& a, const row_crossing_t& b)
+{
+	return (a.y < b.y || (a.y == b.y && a.x < b.x));
+}
+
+// Distance along a ray from (centrex, centrey) in direction (dx, dy) to the line of a segment
+static float getSegmentDistance(const wall_segment_t& segment, float centrex, float centrey, float dx, float dy)
+{
+	if (segment.y_begin == segment.y_end)
+		return (segment.y_begin - centrey) / dy;
+	else
+		return (segment.x_begin - centrex) / dx;
+}
+
+void polygonVisibility(int lightx, int lighty, uint8_t* visible, const tile_rect_t& window)
+{
+	const int window_width = window.x_end - window.x_begin;
+
+	memset(visible, 0, window_width * (window.y_end - window.y_begin));
+
+	// Nothing is lit from inside a wall
+	if (isWall(lightx, lighty))
+		return;
+
+	const tile_rect_t tiles = intersectRects(window, getLevelRect());
+
+	// The walls in the window, closed off by the window's own edges so every ray hits something
+	std::vector<wall_segment_t> segments;
+
+	getWallSegments(tiles, &segments);
+
+	segments.push_back(wall_segment_t{ tiles.x_begin, tiles.y_begin, tiles.x_end, tiles.y_begin });
+	segments.push_back(wall_segment_t{ tiles.x_begin, tiles.y_end, tiles.x_end, tiles.y_end });
+	segments.push_back(wall_segment_t{ tiles.x_begin, tiles.y_begin, tiles.x_begin, tiles.y_end });
+	segments.push_back(wall_segment_t{ tiles.x_end, tiles.y_begin, tiles.x_end, tiles.y_end });
+
+	const float centrex = lightx + 0.5f;
+	const float centrey = lighty + 0.5f;
+
+	// The centre is never on a grid line, so every segment spans an angle
+	// less than pi, and is in the sweep from its anticlockwise first end to
+	// its last, or across -pi if that comes first
+	std::vector<sweep_event_t> events;
+	std::vector<int> active;
+
+	events.reserve(segments.size() * 2);
+
+	for (int i = 0; i < (int)segments.size(); ++i)
+	{
+		const wall_segment_t& segment = segments[i];
+
+		float begin_angle = atan2(segment.y_begin - centrey, segment.x_begin - centrex);
+		float end_angle = atan2(segment.y_end - centrey, segment.x_end - centrex);
+
+		float cross = (segment.x_begin - centrex) * (segment.y_end - centrey) - (segment.y_begin - centrey) * (segment.x_end - centrex);
+
+		if (cross < 0.0f)
+			std::swap(begin_angle, end_angle);
+
+		events.push_back(sweep_event_t{ begin_angle, i, true });
+		events.push_back(sweep_event_t{ end_angle, i, false });
+
+		if (begin_angle > end_angle)
+			active.push_back(i);
+	}
+
+	std::sort(events.begin(), events.end(), compareSweepEvents);
+
+	// Segments don't cross, so between two neighbouring event angles the same
+	// segment is nearest, and the polygon runs along it from one angle to the other
+	std::vector<glm::vec2> polygon;
+
+	polygon.reserve(events.size() * 2);
+
+	for (size_t i = 0; i < events.size();)
+	{
+		const float angle = events[i].angle;
+
+		for (; i < events.size() && events[i].angle == angle; ++i)
+		{
+			if (events[i].begin)
+				active.push_back(events[i].segment);
+			else
+				active.erase(std::find(active.begin(), active.end(), events[i].segment));
+		}
+
+		// The last interval wraps around to the first event
+		const float next_angle = (i < events.size() ? events[i].angle : events[0].angle + 2.0f * PI);
+
+		if (next_angle == angle)
+			continue;
+
+		const float mid_angle = 0.5f * (angle + next_angle);
+
+		const float mid_dx = cos(mid_angle);
+		const float mid_dy = sin(mid_angle);
+
+		int nearest = -1;
+		float nearest_distance = FLT_MAX;
+
+		for (size_t j = 0; j < active.size(); ++j)
+		{
+			float distance = getSegmentDistance(segments[active[j]], centrex, centrey, mid_dx, mid_dy);
+
+			if (distance < nearest_distance)
+			{
+				nearest = active[j];
+				nearest_distance = distance;
+			}
+		}
+
+		if (nearest < 0)
+			continue;
+
+		const float dx[2] = { cos(angle), cos(next_angle) };
+		const float dy[2] = { sin(angle), sin(next_angle) };
+
+		for (int end = 0; end < 2; ++end)
+		{
+			float distance = getSegmentDistance(segments[nearest], centrex, centrey, dx[end], dy[end]);
+
+			polygon.push_back(glm::vec2(centrex + distance * dx[end], centrey + distance * dy[end]));
+		}
+	}
+
+	// Scanline fill, finding where each edge crosses the centre line of each row
+	std::vector<row_crossing_t> crossings;
+
+	for (size_t i = 0; i < polygon.size(); ++i)
+	{
+		const glm::vec2& a = polygon[i];
+		const glm::vec2& b = polygon[(i + 1) % polygon.size()];
+
+		if (a.y == b.y)
+			continue;
+
+		// Rows whose centre y + 0.5 is in [min y, max y)
+		int first = (int)ceil(glm::min(a.y, b.y) - 0.5f);
+		int last = (int)ceil(glm::max(a.y, b.y) - 0.5f);
+
+		first = glm::max(first, tiles.y_begin);
+		last = glm::min(last, tiles.y_end);
+
+		for (int y = first; y < last; ++y)
+		{
+			float t = (y + 0.5f - a.y) / (b.y - a.y);
+
+			crossings.push_back(row_crossing_t{ y, a.x + t * (b.x - a.x) });
+		}
+	}
+
+	std::sort(crossings.begin(), crossings.end(), compareRowCrossings);
+
+	for (size_t i = 0; i < crossings.size();)
+	{
+		const int y = crossings[i].y;
+
+		size_t row_end = i;
+
+		while (row_end < crossings.size() && crossings[row_end].y == y)
+			++row_end;
+
+		uint8_t* row = &visible[(y - window.y_begin) * window_width - window.x_begin];
+
+		// Each pair of crossings along a row encloses the tiles whose centres are
+		// between them, an odd one left over from rounding is dropped
+		for (; i + 1 < row_end; i += 2)
+		{
+			int first = glm::max((int)ceil(crossings[i].x - 0.5f), tiles.x_begin);
+			int last = glm::min((int)ceil(crossings[i + 1].x - 0.5f), tiles.x_end);
+
+			for (int x = first; x < last; ++x)
+				row[x] = 1;
+		}
+
+		i = row_end;
+	}
+}
+
+// Clears the tiles of window whose centres are inside a convex polygon
+static void clearConvexPolygon(const glm::vec2* points, int count, uint8_t* visible, const tile_rect_t& window, const tile_rect_t& tiles)
+{
+	const int window_width = window.x_end - window.x_begin;
+
+	float min_y = FLT_MAX;
+	float max_y = -FLT_MAX;
+
+	for (int i = 0; i < count; ++i)
+	{
+		min_y = glm::min(min_y, points[i].y);
+		max_y = glm::max(max_y, points[i].y);
+	}
+
+	// Rows whose centre y + 0.5 is in [min y, max y)
+	int first_row = glm::max((int)ceil(min_y - 0.5f), tiles.y_begin);
+	int last_row = glm::min((int)ceil(max_y - 0.5f), tiles.y_end);
+
+	for (int y = first_row; y < last_row; ++y)
+	{
+		const float centre_y = y + 0.5f;
+
+		// A convex polygon covers a single span of each row, between the edges crossing its centre line
+		float min_x = FLT_MAX;
+		float max_x = -FLT_MAX;
+
+		for (int i = 0; i < count; ++i)
+		{
+			const glm::vec2& a = points[i];
+			const glm::vec2& b = points[(i + 1) % count];
+
+			if ((a.y <= centre_y) == (b.y <= centre_y))
+				continue;
+
+			float x = a.x + (centre_y - a.y) / (b.y - a.y) * (b.x - a.x);
+
+			min_x = glm::min(min_x, x);
+			max_x = glm::max(max_x, x);
+		}
+
+		if (min_x > max_x)
+			continue;
+
+		int first = (int)glm::max(ceil(min_x - 0.5f), (float)tiles.x_begin);
+		int last = (int)glm::min(ceil(max_x - 0.5f), (float)tiles.x_end);
+
+		if (first < last)
+			memset(&visible[(y - window.y_begin) * window_width + first - window.x_begin], 0, last - first);
+	}
+}
+
+void shadowVolumeVisibility(int lightx, int lighty, uint8_t* visible, const tile_rect_t& window)
+{
+	const int window_width = window.x_end - window.x_begin;
+
+	memset(visible, 0, window_width * (window.y_end - window.y_begin));
+
+	// Nothing is lit from inside a wall
+	if (isWall(lightx, lighty))
+		return;
+
+	const tile_rect_t tiles = intersectRects(window, getLevelRect());
+
+	// Every open tile starts lit
+	for (int y = tiles.y_begin; y < tiles.y_end; ++y)
+	{
+		uint8_t* row = &visible[(y - window.y_begin) * window_width - window.x_begin];
+
+		for (int x = tiles.x_begin; x < tiles.x_end; ++x)
+			row[x] = (getTile(x, y) != '#');
+	}
+
+	std::vector<wall_segment_t> segments;
+
+	getWallSegments(tiles, &segments);
+
+	const glm::vec2 centre(lightx + 0.5f, lighty + 0.5f);
+
+	// Far enough that a shadow's far edges, at no more than pi / 4 from a
+	// point on the circle, stay out of the window
+	const float far_distance = 2.0f * ((tiles.x_end - tiles.x_begin) + (tiles.y_end - tiles.y_begin));
+
+	for (size_t i = 0; i < segments.size(); ++i)
+	{
+		const wall_segment_t& segment = segments[i];
+
+		// Only faces with the wall on the far side from the light cast a shadow,
+		// the shadow of a back face is inside the one cast by the wall's front
+		if (segment.y_begin == segment.y_end)
+		{
+			if (isOccupied(segment.x_begin, segment.y_begin) != (centre.y < segment.y_begin))
+				continue;
+		}
+		else
+		{
+			if (isOccupied(segment.x_begin, segment.y_begin) != (centre.x < segment.x_begin))
+				continue;
+		}
+
+		const glm::vec2 begin((float)segment.x_begin, (float)segment.y_begin);
+		const glm::vec2 end((float)segment.x_end, (float)segment.y_end);
+
+		// Each end is pushed out along the ray from the light, with a third far
+		// point between them so the shadow still reaches the edge when the
+		// segment covers nearly half the view
+		const glm::vec2 far_begin = centre + glm::normalize(begin - centre) * far_distance;
+		const glm::vec2 far_end = centre + glm::normalize(end - centre) * far_distance;
+		const glm::vec2 far_middle = centre + glm::normalize(far_begin + far_end - 2.0f * centre) * far_distance;
+
+		const glm::vec2 shadow[5] = { begin, end, far_end, far_middle, far_begin };
+
+		clearConvexPolygon(shadow, 5, visible, window, tiles);
+	}
+}
+
+int compareVisibility(visibility_mode_t a, visibility_mode_t b, int lightx, int lighty)
+{
+	const int level_size = level_width * level_height;
+
+	std::vector<uint8_t> visible_a(level_size);
+	std::vector<uint8_t> visible_b(level_size);
+
+	computeVisibility(a, lightx, lighty, &visible_a[0]);
+	computeVisibility(b, lightx, lighty, &visible_b[0]);
+
+	int mismatches = 0;
+
+	for (int i = 0; i < level_size; ++i)
+	{
+		if (visible_a[i] != visible_b[i])
+		{
+			printf("Light (%d, %d), tile (%d, %d): %s %s, %s %s\n", lightx, lighty,
+				i % level_width, i / level_width,
+				getVisibilityModeName(a), visible_a[i] ? "lit" : "dark",
+				getVisibilityModeName(b), visible_b[i] ? "lit" : "dark");
+
+			mismatches++;
+		}
+	}
+
+	return mismatches;
+}
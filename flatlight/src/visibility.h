@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "level.h"
+
+// Method used to work out which tiles a light can see
+enum visibility_mode_t
+{
+	VISIBILITY_RAYCAST,			// raycast() from the light to every tile
+	VISIBILITY_SHADOWCAST,		// Recursive shadowcasting, each tile visited once per light
+	VISIBILITY_POLAR,			// 1D polar shadow map of the nearest wall at each angle, approximate
+	VISIBILITY_POLYGON,			// Visibility polygon swept over the wall segments, then rasterised
+	VISIBILITY_SHADOW_VOLUME,	// Shadow cast away from the light by each wall segment, rasterised
+	VISIBILITY_DISTANCE_FIELD,	// raycastDistanceField() from the light to every tile
+
+	VISIBILITY_MODE_COUNT
+};
+
+const char* getVisibilityModeName(visibility_mode_t mode);
+bool parseVisibilityMode(const char* name, visibility_mode_t* mode);
+
+// Fills visible (level_width * level_height) with 1 for every tile lit by a light at (lightx, lighty)
+void computeVisibility(visibility_mode_t mode, int lightx, int lighty, uint8_t* visible);
+
+// As above, but visible only holds the tiles in window, row by row, so
+// visible[(y - window.y_begin) * window width + x - window.x_begin] is tile (x, y)
+// Tiles outside the window are not worked out
+void computeVisibilityWindow(visibility_mode_t mode, int lightx, int lighty, uint8_t* visible, const tile_rect_t& window);
+
+// Returns true if the mode works out each tile on its own, so a light's tiles
+// can be split into rectangles and computed separately
+bool isVisibilityPerTile(visibility_mode_t mode);
+
+// Fills only the tiles of window that are in rect for per-tile modes, other modes fill the whole window
+void computeVisibilityRect(visibility_mode_t mode, int lightx, int lighty, uint8_t* visible,
+	const tile_rect_t& window, const tile_rect_t& rect);
+
+// Per-tile raycast() visibility, the reference the other modes are checked against
+void raycastVisibility(int lightx, int lighty, uint8_t* visible, const tile_rect_t& window, const tile_rect_t& rect);
+
+// Per-tile raycastDistanceField() visibility, the same result as raycastVisibility()
+void distanceFieldVisibility(int lightx, int lighty, uint8_t* visible, const tile_rect_t& window, const tile_rect_t& rect);
+
+// Recursive shadowcasting visibility, giving the same result as raycastVisibility()
+void shadowcastVisibility(int lightx, int lighty, uint8_t* visible, const tile_rect_t& window);
+
+// Angular resolution of the polar shadow map, the number of bins around a light
+extern int polar_bins;
+
+// Polar shadow map visibility: every wall tile in the window is rasterised
+// into the angle bins it covers as seen from the light, keeping the nearest
+// wall distance per bin, then a tile is lit if it is nearer than the wall in its bin
+// Costs O(walls x bins they cover + tiles) rather than a ray per tile, but
+// tiles on shadow edges can differ from raycast(), fewer with more bins, and
+// rays passing exactly through wall corners are not caught at any resolution
+void polarVisibility(int lightx, int lighty, uint8_t* visible, const tile_rect_t& window);
+
+// Visibility polygon: sweeps the wall segments in the window by angle around
+// the light's centre, keeping the nearest segment between each pair of segment
+// ends, and scanline fills the resulting polygon, lighting the tiles whose centres are inside
+// Costs O(segments x segments crossing a ray + tiles), so open levels with
+// long walls are cheap, but the geometry is centre to centre and so can differ from raycast()
+void polygonVisibility(int lightx, int lighty, uint8_t* visible, const tile_rect_t& window);
+
+// Shadow volumes: every wall segment in the window casts a shadow away from
+// the light out past the window's edge, and each is scanline filled, clearing
+// the tiles whose centres are inside it from an all lit mask
+// Costs O(segments x rows they shadow), uses the same centre to centre
+// geometry as polygonVisibility() and mostly gives the same result, but tiles
+// seen along rays that graze the corners where segments meet can differ
+void shadowVolumeVisibility(int lightx, int lighty, uint8_t* visible, const tile_rect_t& window);
+
+// Runs both modes for a light and prints every tile they disagree on, returns the mismatch count
+int compareVisibility(visibility_mode_t a, visibility_mode_t b, int lightx, int lighty);